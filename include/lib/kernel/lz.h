@@ -0,0 +1,19 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stddef.h>
+
+/* LZ77 compression of small buffers. */
+
+/* Size of the scratch space lz_compress() needs. */
+#define LZ_WORK_SIZE (4096 * sizeof (unsigned short))
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65535
+
+size_t lz_compress (const void *src, size_t src_size,
+		void *dst, size_t dst_size, void *work);
+size_t lz_decompress (const void *src, size_t src_size,
+		void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
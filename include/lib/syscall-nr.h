@@ -36,6 +36,20 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Memory advice, for the VM. */
+	SYS_MADVISE,                /* Advise how memory will be used. */
+	SYS_MLOCK,                  /* Keep pages in memory. */
+	SYS_MUNLOCK,                /* Let locked pages be evicted again. */
+};
+
+/* Advice for SYS_MADVISE. */
+enum {
+	MADV_NORMAL,                /* No particular pattern. */
+	MADV_RANDOM,                /* Random access: no read-ahead. */
+	MADV_SEQUENTIAL,            /* Sequential access: read far ahead. */
+	MADV_WILLNEED,              /* Bring the pages in now. */
+	MADV_DONTNEED,              /* Evict the pages now. */
 };
 
 #endif /* lib/syscall-nr.h */
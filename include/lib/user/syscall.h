@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <syscall-nr.h>
 #include "threads/synch.h"
 
 /* Process identifier. */
@@ -44,6 +45,11 @@ int dup2(int oldfd, int newfd);
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
 
+/* Memory advice; MADV_* values are in syscall-nr.h. */
+int madvise (void *addr, size_t length, int advice);
+int mlock (const void *addr, size_t length);
+int munlock (const void *addr, size_t length);
+
 /* Project 4 only. */
 bool chdir (const char *dir);
 bool mkdir (const char *dir);
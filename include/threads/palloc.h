@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -11,13 +12,24 @@ enum palloc_flags {
 	PAL_USER = 004              /* User page. */
 };
 
+/* Moves a user frame from one page to another; see
+   palloc_set_mover(). */
+typedef bool palloc_move_func (void *old_page, void *new_page);
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
 uint64_t palloc_init (void);
+void palloc_zero_init (void);
+void palloc_print_stats (void);
+void palloc_set_mover (palloc_move_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_large_page (enum palloc_flags);
 void palloc_free_page (void *);
+size_t palloc_user_free (void);
 void palloc_free_multiple (void *, size_t page_cnt);
+void clear_page (void *);
+void copy_page (void *dst, const void *src);
 
 #endif /* threads/palloc.h */
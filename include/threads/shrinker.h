@@ -0,0 +1,27 @@
+#ifndef THREADS_SHRINKER_H
+#define THREADS_SHRINKER_H
+
+#include <list.h>
+#include <stddef.h>
+
+/* A cache that can give pages back under memory pressure.
+
+   COUNT returns the number of pages the cache could free right
+   now.  SCAN frees up to NR_TO_SCAN of them and returns how many
+   it freed.  Both are called from inside the page allocator, so
+   they must not allocate memory or block: a SCAN that cannot
+   get its lock without waiting should free nothing instead. */
+struct shrinker {
+	const char *name;                     /* For statistics. */
+	size_t (*count) (struct shrinker *);
+	size_t (*scan) (struct shrinker *, size_t nr_to_scan);
+	struct list_elem elem;                /* Element in shrinker list. */
+	long long freed;                      /* Pages freed so far. */
+};
+
+void shrinker_register (struct shrinker *);
+void shrinker_unregister (struct shrinker *);
+size_t shrink_caches (size_t page_cnt);
+void shrinker_print_stats (void);
+
+#endif /* threads/shrinker.h */
@@ -0,0 +1,25 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+
+/* The vmalloc region: kernel virtual addresses, above the direct
+   map of physical memory, where separately allocated pages are
+   mapped side by side. */
+#define VMALLOC_START 0xc000000000ULL
+#define VMALLOC_END (VMALLOC_START + 64 * 1024 * 1024)
+
+/* True if VADDR lies in the vmalloc region. */
+#define is_vmalloc_vaddr(vaddr) \
+	((uint64_t) (vaddr) >= VMALLOC_START && (uint64_t) (vaddr) < VMALLOC_END)
+
+void vmalloc_init (void);
+void *vmalloc (size_t size);
+void vfree (void *);
+void *vmalloc_pages (enum palloc_flags, size_t page_cnt);
+void vfree_pages (void *, size_t page_cnt);
+
+#endif /* threads/vmalloc.h */
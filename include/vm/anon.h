@@ -4,10 +4,19 @@
 struct page;
 enum vm_type;
 
+/* Most pages swapped out in one burst. */
+#define SWAP_CLUSTER 8
+
 struct anon_page {
+	struct swap_cluster *cluster;   /* Where it is swapped, or NULL. */
+	struct zswap_entry *zentry;     /* Its compressed copy, or NULL. */
+	struct page *next;              /* Next page sharing that copy. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void swap_cluster_begin (size_t cnt);
+void swap_cluster_end (void);
+void vm_anon_print_stats (void);
 
 #endif
@@ -6,7 +6,20 @@
 struct page;
 enum vm_type;
 
+/* A region mapped by mmap(), or the read-only text of a program.
+ * Its pages share FILE, reopened for the region, which is closed
+ * along with the last of them.  After fork, parent and child share
+ * the region too. */
+struct mmap_region {
+	struct file *file;
+	size_t page_cnt;            /* Pages left, in all processes. */
+	bool text;                  /* Program text, not from mmap()? */
+};
+
 struct file_page {
+	struct mmap_region *region; /* Region the page belongs to. */
+	off_t ofs;                  /* Offset of the page in the file. */
+	size_t read_bytes;          /* Bytes from the file; then zeros. */
 };
 
 void vm_file_init (void);
@@ -14,4 +27,10 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+bool do_mmap_text (struct file *file, off_t ofs, void *addr,
+		size_t read_bytes);
+struct frame *file_page_lookup (struct page *page);
+struct page *file_page_dup (struct page *src);
+void file_write_back (struct frame **frames, size_t cnt);
+void vm_file_print_stats (void);
 #endif
@@ -0,0 +1,22 @@
+#ifndef VM_POLICY_H
+#define VM_POLICY_H
+#include <stdbool.h>
+
+struct frame;
+
+/* A page-replacement policy.  The frame table tells the policy
+ * when a frame starts and stops holding a page, and asks it which
+ * frame to evict.  All calls are made with the frame lock held. */
+struct vm_policy {
+	const char *name;
+	void (*add) (struct frame *);        /* FRAME now holds a page. */
+	void (*remove) (struct frame *);     /* FRAME no longer does. */
+	struct frame *(*victim) (void);      /* Frame to evict, or NULL. */
+};
+
+extern const struct vm_policy *vm_policy;
+
+void vm_policy_init (void);
+bool vm_policy_select (const char *name);
+
+#endif /* vm/policy.h */
@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -24,6 +27,9 @@ enum vm_type {
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Marks the pages of the user stack. */
+#define VM_STACK VM_MARKER_0
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
@@ -46,6 +52,12 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* May the user process write it? */
+	uint64_t *pml4;        /* Page table that maps it. */
+	struct list_elem frame_elem;  /* In its frame's list of pages. */
+	uint8_t advice;        /* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL. */
+	bool mlocked;          /* Locked in memory by mlock()? */
+	bool mlock_new;        /* Locked by the mlock() in progress? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +71,45 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * A frame can hold several pages, of one or more processes:
+ *
+ * - After fork, the same anonymous page, copy-on-write: each of
+ *   them maps it read-only until it writes to it and gets a copy
+ *   of its own.
+ *
+ * - Pages that map the same part of the same file, which share
+ *   the frame for good, through file.c's page index.
+ *
+ * PAGES is the frame's reverse map.  Each page in it records the
+ * page table and address it is mapped at, so walking it finds
+ * every PTE that maps the frame, to unmap them all on eviction or
+ * to gather their accessed and dirty bits. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;           /* First of PAGES, or NULL. */
+	struct list pages;           /* Pages that share this frame. */
+	size_t ref_cnt;              /* Number of PAGES. */
+	bool pinned;                 /* Must not be evicted or moved. */
+	bool io;                     /* Being written out by kswapd? */
+	struct list_elem elem;       /* Element in the frame table. */
+
+	/* Owned by file.c. */
+	struct inode *inode;         /* File it holds part of, or NULL. */
+	off_t ofs;                   /* Offset of that part in INODE. */
+	size_t text_bytes;           /* For program text, bytes read. */
+	bool dirty;                  /* Written by pages since unmapped? */
+	struct hash_elem index_elem; /* Element in the page index. */
+
+	/* Owned by vm.c's same-page merging. */
+	uint64_t ksm_hash;           /* Hash of the contents when scanned. */
+	bool ksm_listed;             /* In the table of merge candidates? */
+	struct hash_elem ksm_elem;   /* Element in that table. */
+
+	/* Owned by policy.c. */
+	struct list_elem queue_elem; /* Element in a replacement queue. */
+	bool protected;              /* In 2q's protected queue? */
+	bool seen;                   /* Accessed bit cleared on probation? */
 };
 
 /* The function table for page operations.
@@ -82,11 +129,39 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ *
+ * A radix tree with the same shape as the x86-64 page table: four
+ * levels of 512-entry nodes, indexed by the PML4, PDPE, PDX and
+ * PTX fields of the virtual address.  A lookup is at most four
+ * dependent loads, and walking the leaves visits the pages in
+ * address order.  Each node fills one page of the kernel pool. */
 struct supplemental_page_table {
+	void **root;           /* Top level node, or NULL if empty. */
+	size_t page_cnt;       /* Number of pages in the table. */
+
+	/* Fault-around; see vm_fault_around(). */
+	void *around_start;    /* Page of the last fault. */
+	void *around_end;      /* End of the pages mapped after it. */
+	size_t around_window;  /* Pages to map after the next fault. */
+
+	/* Stack growth; see vm_stack_growth(). */
+	void *stack_bottom;    /* Lowest page of the stack. */
+	size_t stack_chunk;    /* Pages the stack last grew by. */
+
+	size_t mlock_cnt;      /* Pages locked by mlock(). */
 };
 
+/* Where a lazily loaded page gets its contents: READ_BYTES bytes
+ * of FILE starting at OFS, followed by zeros.  FILE is a private
+ * reopening of the file, closed by load_info_free(). */
+struct load_info {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
+};
+
+typedef bool spt_for_each_func (struct page *, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -96,8 +171,43 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct page *spt_next_page (struct supplemental_page_table *spt, void *va);
+bool spt_for_each (struct supplemental_page_table *spt, void *start, void *end,
+		spt_for_each_func *func, void *aux);
+
+struct load_info *load_info_new (struct file *file, off_t ofs,
+		size_t read_bytes);
+struct load_info *load_info_copy (const struct load_info *info);
+void load_info_free (struct load_info *info);
+bool vm_load_file_page (struct page *page, void *aux);
+
+/* Most pages to map around a fault; -faultaround=N sets it, up to
+ * FAULT_AROUND_MAX. */
+extern size_t vm_fault_around_max;
+#define FAULT_AROUND_MAX 512
+
+/* Most pages of user stack, and how many of them a new process
+ * starts with; -stackmax=N and -stackinit=N set them, up to
+ * STACK_PAGES_MAX, all of user space below USER_STACK but page 0,
+ * which stays unmapped so that null pointers still fault. */
+extern size_t vm_stack_max;
+extern size_t vm_stack_initial;
+#define STACK_PAGES_MAX (USER_STACK / PGSIZE - 1)
+
+/* Frames to scan for same-page merging per pass, or 0 not to merge;
+ * -ksm=N sets it, up to KSM_PAGES_MAX. */
+extern size_t vm_ksm_pages;
+#define KSM_PAGES_MAX 4096
+
+/* Free user pages below which background reclaim starts, or 0 for
+ * none, and up to which it goes on; -kswapd=LOW,HIGH sets them, up
+ * to RECLAIM_PAGES_MAX. */
+extern size_t vm_reclaim_low;
+extern size_t vm_reclaim_high;
+#define RECLAIM_PAGES_MAX (1 << 20)
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +217,17 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_setup_stack (void);
+void frame_link (struct frame *frame, struct page *page);
+bool frame_test_and_clear_accessed (struct frame *frame);
+bool frame_is_dirty (struct frame *frame);
+void frame_clear_dirty (struct frame *frame);
+void vm_write_back (struct supplemental_page_table *spt, void *start,
+		void *end);
+void *vm_prefetch_begin (struct page *page);
+void vm_prefetch_end (struct page *page);
+int vm_madvise (void *addr, size_t length, int advice);
+int vm_mlock (void *addr, size_t length, bool lock);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,192 @@
+#include "lz.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* A fast LZ77 compressor in the style of LZ4.
+
+   The output is a series of sequences.  Each starts with a token
+   byte whose high nibble is the number of literal bytes that
+   follow and whose low nibble is the length of the match after
+   them, minus MIN_MATCH.  A nibble of 15 means that the length
+   continues in the following bytes, each added to it, until one
+   is less than 255.  After the literals comes the match: a
+   2-byte little-endian distance back into the output, and then
+   the match length bytes, if any.  The last sequence has only
+   literals.
+
+   Matches are found through a hash table of the positions of
+   recent 4-byte strings, without any search, which finds fewer
+   matches than a real search would but costs only a few
+   instructions per input byte. */
+
+#define MIN_MATCH 4             /* Shortest match encoded. */
+#define HASH_BITS 12            /* Log2 of hash table entries. */
+#define LAST_LITERALS 5         /* Trailing bytes never matched. */
+
+/* Returns the 4 bytes at P as an integer. */
+static inline uint32_t
+load32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Hashes the 4 bytes at P. */
+static inline unsigned
+hash4 (const uint8_t *p) {
+	return (load32 (p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends length LEN, beyond the nibble that already holds 15, to
+   the output at *OP.  Returns false if it would not fit before
+   END. */
+static bool
+put_length (uint8_t **op, uint8_t *end, size_t len) {
+	for (; len >= 255; len -= 255) {
+		if (*op >= end)
+			return false;
+		*(*op)++ = 255;
+	}
+	if (*op >= end)
+		return false;
+	*(*op)++ = len;
+	return true;
+}
+
+/* Writes a sequence of the LIT_LEN literals at LIT followed, if
+   MATCH_LEN is nonzero, by a match of MATCH_LEN bytes at DIST
+   back.  Returns false if it does not fit before END. */
+static bool
+put_sequence (uint8_t **op, uint8_t *end, const uint8_t *lit, size_t lit_len,
+		size_t dist, size_t match_len) {
+	uint8_t *token = (*op)++;
+	size_t ml = match_len != 0 ? match_len - MIN_MATCH : 0;
+
+	if (token >= end)
+		return false;
+	*token = (lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15);
+	if (lit_len >= 15 && !put_length (op, end, lit_len - 15))
+		return false;
+	if ((size_t) (end - *op) < lit_len)
+		return false;
+	memcpy (*op, lit, lit_len);
+	*op += lit_len;
+
+	if (match_len == 0)
+		return true;
+	if (end - *op < 2)
+		return false;
+	*(*op)++ = dist & 0xff;
+	*(*op)++ = dist >> 8;
+	return ml < 15 || put_length (op, end, ml - 15);
+}
+
+/* Compresses the SRC_SIZE bytes at SRC into DST, which has room for
+   DST_SIZE bytes, using WORK, which must be LZ_WORK_SIZE bytes, as
+   scratch space.  Returns the size of the compressed data, or 0 if
+   it would not fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+		void *dst_, size_t dst_size, void *work) {
+	const uint8_t *src = src_;
+	const uint8_t *ip = src, *anchor = src;
+	const uint8_t *limit = src + (src_size > LAST_LITERALS + MIN_MATCH
+		? src_size - LAST_LITERALS - MIN_MATCH : 0);
+	const uint8_t *end = src + src_size;
+	uint8_t *op = dst_, *op_end = op + dst_size;
+	unsigned short *table = work;
+
+	ASSERT (src_size <= LZ_MAX_INPUT);
+
+	memset (table, 0, LZ_WORK_SIZE);
+	while (ip < limit) {
+		unsigned h = hash4 (ip);
+		const uint8_t *ref = src + table[h];
+		size_t len;
+
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > 0xffff
+				|| load32 (ref) != load32 (ip)) {
+			ip++;
+			continue;
+		}
+
+		/* Extend the match as far as it goes, leaving the last bytes
+		   for literals. */
+		len = MIN_MATCH;
+		while (ip + len < end - LAST_LITERALS && ref[len] == ip[len])
+			len++;
+
+		if (!put_sequence (&op, op_end, anchor, ip - anchor, ip - ref,
+					len))
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+
+	if (!put_sequence (&op, op_end, anchor, end - anchor, 0, 0))
+		return 0;
+	return op - (uint8_t *) dst_;
+}
+
+/* Reads a length continued beyond a nibble of 15 from *IP, which
+   must stay before END, and adds it to *LEN.  Returns false if the
+   input is truncated. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lz_compress(), into DST, which has room for DST_SIZE bytes.
+   Returns the size of the decompressed data, or 0 if SRC is
+   malformed or would not fit. */
+size_t
+lz_decompress (const void *src_, size_t src_size,
+		void *dst_, size_t dst_size) {
+	const uint8_t *ip = src_, *end = ip + src_size;
+	uint8_t *dst = dst_, *op = dst, *op_end = dst + dst_size;
+
+	while (ip < end) {
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4, match_len = token & 15, dist;
+		const uint8_t *ref;
+
+		if (lit_len == 15 && !get_length (&ip, end, &lit_len))
+			return 0;
+		if ((size_t) (end - ip) < lit_len
+				|| (size_t) (op_end - op) < lit_len)
+			return 0;
+		memcpy (op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return 0;
+		dist = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (match_len == 15 && !get_length (&ip, end, &match_len))
+			return 0;
+		match_len += MIN_MATCH;
+		if (dist == 0 || dist > (size_t) (op - dst)
+				|| (size_t) (op_end - op) < match_len)
+			return 0;
+
+		/* The match may overlap the bytes it produces. */
+		for (ref = op - dist; match_len > 0; match_len--)
+			*op++ = *ref++;
+	}
+	return op - dst;
+}
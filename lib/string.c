@@ -1,5 +1,91 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The block operations below work a word at a time, and hand
+   large blocks to the x86 string instructions, which move whole
+   cache lines internally.  On CPUs with "enhanced REP MOVSB/STOSB"
+   (ERMS), the byte forms are the fastest way to move any block
+   large enough to use them at all; otherwise REP MOVSQ/STOSQ
+   is used on an aligned destination.  Short blocks are not worth
+   the startup cost of a string instruction. */
+
+/* An 8-byte word that may alias any other type. */
+typedef uint64_t __attribute__ ((may_alias)) word_t;
+#define WORD_SIZE sizeof (word_t)
+
+/* Blocks at least this long use string instructions. */
+#define REP_MIN 64
+
+/* Each byte of a word set to 0x01 and 0x80, respectively. */
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Nonzero if word W contains a zero byte. */
+#define has_zero_byte(W) (((W) - ONES) & ~(W) & HIGHS)
+
+/* Returns true if the CPU supports ERMS.  The answer is cached
+   in an initialized variable, so that it survives the kernel
+   clearing its BSS with memset(). */
+static bool
+has_erms (void) {
+	static int erms = -1;
+
+	if (erms < 0) {
+		uint32_t eax, ebx, ecx, edx;
+
+		__asm __volatile ("cpuid"
+				: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (0));
+		ebx = 0;
+		if (eax >= 7)
+			__asm __volatile ("cpuid"
+					: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+					: "a" (7), "c" (0));
+		erms = (ebx & (1 << 9)) != 0;
+	}
+	return erms;
+}
+
+/* Copies SIZE bytes from SRC to DST with string instructions.
+   SIZE must be at least WORD_SIZE. */
+static void
+rep_copy (unsigned char *dst, const unsigned char *src, size_t size) {
+	if (!has_erms ()) {
+		size_t head = -(uintptr_t) dst & (WORD_SIZE - 1);
+		size_t words;
+
+		size -= head;
+		words = size / WORD_SIZE;
+		size %= WORD_SIZE;
+		__asm __volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+		__asm __volatile ("rep movsq"
+				: "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+	}
+	__asm __volatile ("rep movsb"
+			: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
+
+/* Sets SIZE bytes at DST to the byte repeated in PATTERN, with
+   string instructions.  SIZE must be at least WORD_SIZE. */
+static void
+rep_fill (unsigned char *dst, uint64_t pattern, size_t size) {
+	if (!has_erms ()) {
+		size_t head = -(uintptr_t) dst & (WORD_SIZE - 1);
+		size_t words;
+
+		size -= head;
+		words = size / WORD_SIZE;
+		size %= WORD_SIZE;
+		__asm __volatile ("rep stosb"
+				: "+D" (dst), "+c" (head) : "a" (pattern) : "memory");
+		__asm __volatile ("rep stosq"
+				: "+D" (dst), "+c" (words) : "a" (pattern) : "memory");
+	}
+	__asm __volatile ("rep stosb"
+			: "+D" (dst), "+c" (size) : "a" (pattern) : "memory");
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,6 +97,16 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
+	if (size >= REP_MIN) {
+		rep_copy (dst, src, size);
+		return dst_;
+	}
+
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		*(word_t *) dst = *(const word_t *) src;
+		dst += WORD_SIZE;
+		src += WORD_SIZE;
+	}
 	while (size-- > 0)
 		*dst++ = *src++;
 
@@ -27,17 +123,24 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
-	} else {
-		dst += size;
-		src += size;
-		while (size-- > 0)
-			*--dst = *--src;
+	/* Copying forward is safe unless DST starts inside SRC. */
+	if (dst <= src || dst >= src + size)
+		return memcpy (dst_, src_, size);
+
+	/* Copy backward.  Each word is loaded before it is stored, and
+	   no later load reaches a byte already stored, so overlap
+	   within a word is harmless too. */
+	dst += size;
+	src += size;
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		dst -= WORD_SIZE;
+		src -= WORD_SIZE;
+		*(word_t *) dst = *(const word_t *) src;
 	}
+	while (size-- > 0)
+		*--dst = *--src;
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +155,13 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip past equal words, then find the differing byte. */
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
+		a += WORD_SIZE;
+		b += WORD_SIZE;
+	}
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -258,22 +368,43 @@ void *
 memset (void *dst_, int value, size_t size) {
 	unsigned char *dst = dst_;
 
+	uint64_t pattern = (unsigned char) value * ONES;
+
 	ASSERT (dst != NULL || size == 0);
 
+	if (size >= REP_MIN) {
+		rep_fill (dst, pattern, size);
+		return dst_;
+	}
+
+	for (; size >= WORD_SIZE; size -= WORD_SIZE) {
+		*(word_t *) dst = pattern;
+		dst += WORD_SIZE;
+	}
 	while (size-- > 0)
 		*dst++ = value;
 
 	return dst_;
 }
 
-/* Returns the length of STRING. */
+/* Returns the length of STRING.  Once P is aligned, whole words
+   are examined at a time.  An aligned word never crosses a page
+   boundary, so reading past the null terminator is harmless. */
 size_t
 strlen (const char *string) {
 	const char *p;
+	const word_t *w;
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
+	for (p = string; (uintptr_t) p & (WORD_SIZE - 1); p++)
+		if (*p == '\0')
+			return p - string;
+
+	for (w = (const word_t *) p; !has_zero_byte (*w); w++)
+		continue;
+
+	for (p = (const char *) w; *p != '\0'; p++)
 		continue;
 	return p - string;
 }
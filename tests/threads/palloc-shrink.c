@@ -0,0 +1,130 @@
+/* Checks that memory held by kernel caches is given back when
+   the page allocator runs out.
+
+   First counts how many pages can be allocated before the
+   allocator fails.  Then parks some pages in a cache of the
+   test's own, with a shrinker that frees them, and counts again:
+   the allocator must get every parked page back through the
+   shrinker before it fails.  Last, fills malloc's cache of spare
+   arenas by allocating and freeing many blocks, and counts a
+   third time.  Without shrinkers, the cached pages would stay out
+   of reach and the later counts would come up short. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/shrinker.h"
+#include "threads/vaddr.h"
+
+/* Pages to park in the test's cache. */
+#define CACHE_CNT 32
+
+/* Blocks to allocate to fill the arena cache. */
+#define BLOCK_CNT 64
+#define BLOCK_SIZE 1024
+
+/* The test's cache: pages it could do without. */
+static void *cache[CACHE_CNT];
+static size_t cache_cnt;
+
+static size_t
+cache_count (struct shrinker *s UNUSED)
+{
+  return cache_cnt;
+}
+
+static size_t
+cache_scan (struct shrinker *s UNUSED, size_t nr_to_scan)
+{
+  size_t freed;
+
+  for (freed = 0; freed < nr_to_scan && cache_cnt > 0; freed++)
+    palloc_free_page (cache[--cache_cnt]);
+  return freed;
+}
+
+static struct shrinker cache_shrinker = {
+  .name = "palloc-shrink",
+  .count = cache_count,
+  .scan = cache_scan,
+};
+
+/* Allocates pages until none are left, then frees them all.
+   Returns the number allocated. */
+static size_t
+exhaust_pages (void)
+{
+  void *head = NULL;
+  size_t cnt = 0;
+  void **page;
+
+  while ((page = palloc_get_page (0)) != NULL)
+    {
+      *page = head;
+      head = page;
+      cnt++;
+    }
+  while (head != NULL)
+    {
+      page = head;
+      head = *page;
+      palloc_free_page (page);
+    }
+  return cnt;
+}
+
+/* Fails if AFTER pages could be allocated, fewer than the BEFORE
+   that could at first.  The zeroing thread may be holding a page
+   or two. */
+static void
+check_count (size_t before, size_t after)
+{
+  if (after + 2 < before)
+    fail ("%zu pages available at first, only %zu later", before, after);
+}
+
+void
+test_palloc_shrink (void)
+{
+  void *blocks[BLOCK_CNT];
+  size_t before, after;
+  int i;
+
+  msg ("allocating until out of memory");
+  before = exhaust_pages ();
+
+  msg ("parking %d pages in a cache", CACHE_CNT);
+  for (cache_cnt = 0; cache_cnt < CACHE_CNT; cache_cnt++)
+    {
+      cache[cache_cnt] = palloc_get_page (0);
+      if (cache[cache_cnt] == NULL)
+        fail ("palloc_get_page failed");
+    }
+  shrinker_register (&cache_shrinker);
+
+  msg ("allocating until out of memory again");
+  after = exhaust_pages ();
+  shrinker_unregister (&cache_shrinker);
+  if (cache_cnt != 0)
+    fail ("%zu pages still parked in the cache", cache_cnt);
+  if (cache_shrinker.freed != CACHE_CNT)
+    fail ("shrinker freed %lld pages, not %d",
+          cache_shrinker.freed, CACHE_CNT);
+  check_count (before, after);
+
+  msg ("filling malloc's arena cache");
+  for (i = 0; i < BLOCK_CNT; i++)
+    {
+      blocks[i] = malloc (BLOCK_SIZE);
+      if (blocks[i] == NULL)
+        fail ("malloc failed");
+    }
+  for (i = 0; i < BLOCK_CNT; i++)
+    free (blocks[i]);
+
+  msg ("allocating until out of memory a third time");
+  after = exhaust_pages ();
+  check_count (before, after);
+  pass ();
+}
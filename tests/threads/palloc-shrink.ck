@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-shrink) begin
+(palloc-shrink) allocating until out of memory
+(palloc-shrink) parking 32 pages in a cache
+(palloc-shrink) allocating until out of memory again
+(palloc-shrink) filling malloc's arena cache
+(palloc-shrink) allocating until out of memory a third time
+(palloc-shrink) PASS
+(palloc-shrink) end
+EOF
+pass;
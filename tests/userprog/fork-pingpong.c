@@ -0,0 +1,48 @@
+/* Benchmark: forks a child and waits for it, over and over, and
+   reports the average cost of one fork/exit/wait round trip in
+   CPU cycles.  Switching between parent and child dominates, so
+   this measures address space switch overhead.  The number of
+   rounds may be given as the first command-line argument.
+
+   Not part of the graded tests, since its output varies from run
+   to run: run it with "pintos -- -q run fork-pingpong". */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "fork-pingpong";
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi (argv[1]) : 100;
+  uint64_t start, cycles;
+  int i;
+
+  quiet = true;
+  start = rdtsc ();
+  for (i = 0; i < rounds; i++)
+    {
+      pid_t pid = fork ("pong");
+      if (pid == 0)
+        exit (0);
+      if (pid < 0 || wait (pid) != 0)
+        fail ("round %d failed", i);
+    }
+  cycles = rdtsc () - start;
+
+  quiet = false;
+  msg ("%d rounds, %lld cycles per round", rounds,
+       (long long) (cycles / (rounds > 0 ? rounds : 1)));
+  return 0;
+}
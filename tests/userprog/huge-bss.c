@@ -0,0 +1,60 @@
+/* Touches every page of a 4 MB zero-initialized array aligned to
+   2 MB, which the loader may map with large pages, then forks and
+   checks that the child sees a copy of the parent's contents and
+   that the copies stay apart when either side writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HUGE_SIZE (4 * 1024 * 1024)
+#define PAGE_SIZE 4096
+
+static char buf[HUGE_SIZE] __attribute__ ((aligned (2 * 1024 * 1024)));
+
+/* Checks that every page of BUF starts with the byte page number
+   plus BIAS. */
+static void
+check_pages (int bias)
+{
+  size_t i;
+
+  for (i = 0; i < HUGE_SIZE / PAGE_SIZE; i++)
+    if (buf[i * PAGE_SIZE] != (char) (i + bias))
+      fail ("page %zu holds %d, expected %d", i, buf[i * PAGE_SIZE],
+            (char) (i + bias));
+}
+
+void
+test_main (void)
+{
+  size_t i;
+  pid_t pid;
+
+  for (i = 0; i < HUGE_SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu is %d before being written", i, buf[i]);
+
+  msg ("touch every page");
+  for (i = 0; i < HUGE_SIZE / PAGE_SIZE; i++)
+    buf[i * PAGE_SIZE] = i;
+  check_pages (0);
+
+  pid = fork ("child");
+  if (pid == 0)
+    {
+      check_pages (0);
+      for (i = 0; i < HUGE_SIZE / PAGE_SIZE; i++)
+        buf[i * PAGE_SIZE] = i + 1;
+      check_pages (1);
+      exit (81);
+    }
+  if (pid < 0)
+    fail ("fork failed");
+  if (wait (pid) != 81)
+    fail ("child failed");
+
+  msg ("parent's copy unchanged");
+  check_pages (0);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(huge-bss) begin
+(huge-bss) touch every page
+child: exit(81)
+(huge-bss) parent's copy unchanged
+(huge-bss) end
+huge-bss: exit(0)
+EOF
+pass;
@@ -0,0 +1,87 @@
+/* Benchmark: times memcpy, memmove, memset, memcmp and strlen on
+   blocks from 1 byte to 64 kB and reports the average cost of
+   one call in CPU cycles for each size.  The number of
+   iterations per size may be given as the first command-line
+   argument.
+
+   Not part of the graded tests, since its output varies from run
+   to run: run it with "pintos -- -q run string-bench". */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "string-bench";
+
+#define MAX_SIZE (64 * 1024)
+
+static char src[MAX_SIZE + 1];
+static char dst[MAX_SIZE + 1];
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int iterations = argc > 1 ? atoi (argv[1]) : 100;
+  size_t size;
+
+  if (iterations < 1)
+    iterations = 1;
+
+  memset (src, 'x', MAX_SIZE);
+  msg ("%8s %8s %8s %8s %8s %8s", "size", "memcpy", "memmove",
+       "memset", "memcmp", "strlen");
+  for (size = 1; size <= MAX_SIZE; size *= 2)
+    {
+      uint64_t cycles[5];
+      uint64_t start;
+      int i;
+
+      /* memmove is timed on an overlapping, backward copy. */
+      start = rdtsc ();
+      for (i = 0; i < iterations; i++)
+        memcpy (dst, src, size);
+      cycles[0] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iterations; i++)
+        memmove (dst + 1, dst, size);
+      cycles[1] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iterations; i++)
+        memset (dst, 'x', size);
+      cycles[2] = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < iterations; i++)
+        if (memcmp (dst, src, size) != 0)
+          fail ("memcmp reported a difference at size %zu", size);
+      cycles[3] = rdtsc () - start;
+
+      src[size] = '\0';
+      start = rdtsc ();
+      for (i = 0; i < iterations; i++)
+        if (strlen (src) != size)
+          fail ("strlen returned the wrong length at size %zu", size);
+      cycles[4] = rdtsc () - start;
+      src[size] = 'x';
+
+      msg ("%8zu %8lld %8lld %8lld %8lld %8lld", size,
+           (long long) (cycles[0] / iterations),
+           (long long) (cycles[1] / iterations),
+           (long long) (cycles[2] / iterations),
+           (long long) (cycles[3] / iterations),
+           (long long) (cycles[4] / iterations));
+    }
+  return 0;
+}
@@ -0,0 +1,62 @@
+/* Benchmark: fills a 1 MB buffer, then forks a child and waits
+   for it, over and over, and reports the average cost of one
+   fork/exit/wait round trip in CPU cycles.  Each child writes to
+   a single page of the buffer before it exits, so the cost is
+   dominated by how fork duplicates the parent's memory: copying
+   every page, or sharing them copy-on-write.  The number of
+   rounds may be given as the first command-line argument.
+
+   Not part of the graded tests, since its output varies from run
+   to run: run it with "pintos -- -q run fork-bench". */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "fork-bench";
+
+#define BUF_SIZE (1024 * 1024)
+#define PAGE_SIZE 4096
+
+static char buf[BUF_SIZE];
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi (argv[1]) : 50;
+  uint64_t start, cycles;
+  int i;
+
+  memset (buf, 0x5a, sizeof buf);
+
+  quiet = true;
+  start = rdtsc ();
+  for (i = 0; i < rounds; i++)
+    {
+      pid_t pid = fork ("child");
+      if (pid == 0)
+        {
+          buf[i % (BUF_SIZE / PAGE_SIZE) * PAGE_SIZE] = 0;
+          exit (0);
+        }
+      if (pid < 0 || wait (pid) != 0)
+        fail ("round %d failed", i);
+    }
+  cycles = rdtsc () - start;
+
+  quiet = false;
+  msg ("%d rounds of fork with %d kB resident, %lld cycles per round",
+       rounds, BUF_SIZE / 1024,
+       (long long) (cycles / (rounds > 0 ? rounds : 1)));
+  return 0;
+}
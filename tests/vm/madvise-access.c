@@ -0,0 +1,57 @@
+/* Gives each of the access-pattern hints to a file mapping and to
+   anonymous memory, and checks that their contents read back
+   unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 8
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+/* Reads every page of BUF back and checks the byte written to it. */
+static void
+check_buf (void)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) (i + 1))
+      fail ("page %zu of buf holds %d", i, buf[i * PAGE_SIZE]);
+}
+
+void
+test_main (void)
+{
+  static const int advice[] = {MADV_RANDOM, MADV_SEQUENTIAL, MADV_NORMAL};
+  static const char *names[] = {"random", "sequential", "normal"};
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    buf[i * PAGE_SIZE] = i + 1;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, 0, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+
+  for (i = 0; i < sizeof advice / sizeof *advice; i++)
+    {
+      CHECK (madvise (actual, 4096, advice[i]) == 0,
+             "advise %s access to mapping", names[i]);
+      if (memcmp (actual, sample, strlen (sample)))
+        fail ("read of mmap'd file reported bad data");
+      CHECK (madvise (buf, sizeof buf, advice[i]) == 0,
+             "advise %s access to buf", names[i]);
+      check_buf ();
+    }
+
+  munmap (map);
+  close (handle);
+}
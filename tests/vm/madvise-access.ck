@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-access) begin
+(madvise-access) open "sample.txt"
+(madvise-access) mmap "sample.txt"
+(madvise-access) advise random access to mapping
+(madvise-access) advise random access to buf
+(madvise-access) advise sequential access to mapping
+(madvise-access) advise sequential access to buf
+(madvise-access) advise normal access to mapping
+(madvise-access) advise normal access to buf
+(madvise-access) end
+madvise-access: exit(0)
+EOF
+pass;
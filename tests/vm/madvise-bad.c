@@ -0,0 +1,27 @@
+/* Passes bad ranges and bad advice to madvise, which must return
+   -1 for each. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+static char buf[2 * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  void *kernel = (void *) 0x8004000000;
+
+  CHECK (madvise (buf + 1, PAGE_SIZE, MADV_NORMAL) == -1,
+         "misaligned address");
+  CHECK (madvise (buf, 0, MADV_NORMAL) == -1, "zero length");
+  CHECK (madvise (kernel, PAGE_SIZE, MADV_DONTNEED) == -1,
+         "kernel address");
+  CHECK (madvise (kernel - PAGE_SIZE, 2 * PAGE_SIZE, MADV_DONTNEED) == -1,
+         "range reaching into the kernel");
+  CHECK (madvise (buf, PAGE_SIZE, -1) == -1, "advice -1");
+  CHECK (madvise (buf, PAGE_SIZE, MADV_DONTNEED + 1) == -1,
+         "advice past MADV_DONTNEED");
+}
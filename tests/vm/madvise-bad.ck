@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-bad) begin
+(madvise-bad) misaligned address
+(madvise-bad) zero length
+(madvise-bad) kernel address
+(madvise-bad) range reaching into the kernel
+(madvise-bad) advice -1
+(madvise-bad) advice past MADV_DONTNEED
+(madvise-bad) end
+madvise-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Writes to an array and to a writable file mapping, evicts them
+   with MADV_DONTNEED, and checks that the pages are gone but that
+   touching them again brings back what was written: unlike in
+   Unix, MADV_DONTNEED keeps the contents. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 8
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  static const char overwrite[] = "This line was written through a mapping.";
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    memset (&buf[i * PAGE_SIZE], i + 1, PAGE_SIZE);
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+  memcpy (actual, overwrite, strlen (overwrite));
+
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0, "evict buf");
+  CHECK (madvise (actual, 4096, MADV_DONTNEED) == 0, "evict mapping");
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (get_phys_addr (&buf[i * PAGE_SIZE]) != 0)
+      fail ("page %zu of buf still present", i);
+  if (get_phys_addr (actual) != 0)
+    fail ("mapping still present");
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != (char) (i / PAGE_SIZE + 1))
+      fail ("byte %zu of buf holds %d after eviction", i, buf[i]);
+  if (memcmp (actual, overwrite, strlen (overwrite)))
+    fail ("mapping lost what was written to it");
+
+  munmap (map);
+  close (handle);
+}
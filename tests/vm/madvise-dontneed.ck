@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-dontneed) begin
+(madvise-dontneed) open "sample.txt"
+(madvise-dontneed) mmap "sample.txt"
+(madvise-dontneed) evict buf
+(madvise-dontneed) evict mapping
+(madvise-dontneed) end
+madvise-dontneed: exit(0)
+EOF
+pass;
@@ -0,0 +1,55 @@
+/* Evicts the pages of an array and a file mapping with
+   MADV_DONTNEED, then brings them back with MADV_WILLNEED and
+   checks that they are present again, with the same contents,
+   before they are touched. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 8
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    buf[i * PAGE_SIZE] = i + 1;
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, 0, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0, "evict buf");
+  CHECK (madvise (actual, 4096, MADV_DONTNEED) == 0, "evict mapping");
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (get_phys_addr (&buf[i * PAGE_SIZE]) != 0)
+      fail ("page %zu of buf still present", i);
+  if (get_phys_addr (actual) != 0)
+    fail ("mapping still present");
+
+  CHECK (madvise (buf, sizeof buf, MADV_WILLNEED) == 0, "prefetch buf");
+  CHECK (madvise (actual, 4096, MADV_WILLNEED) == 0, "prefetch mapping");
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (get_phys_addr (&buf[i * PAGE_SIZE]) == 0)
+      fail ("page %zu of buf not present", i);
+  if (get_phys_addr (actual) == 0)
+    fail ("mapping not present");
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) (i + 1))
+      fail ("page %zu of buf holds %d", i, buf[i * PAGE_SIZE]);
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(madvise-willneed) begin
+(madvise-willneed) open "sample.txt"
+(madvise-willneed) mmap "sample.txt"
+(madvise-willneed) evict buf
+(madvise-willneed) evict mapping
+(madvise-willneed) prefetch buf
+(madvise-willneed) prefetch mapping
+(madvise-willneed) end
+madvise-willneed: exit(0)
+EOF
+pass;
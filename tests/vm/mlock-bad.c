@@ -0,0 +1,39 @@
+/* Passes bad ranges to mlock and munlock, which must return -1
+   for each, and checks that mlock refuses to lock more than a
+   process may without locking any of the range. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define MLOCK_MAX 64
+
+static char buf[(MLOCK_MAX + 1) * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  void *kernel = (void *) 0x8004000000;
+  size_t i;
+
+  CHECK (mlock (buf + 1, PAGE_SIZE) == -1, "mlock misaligned address");
+  CHECK (mlock (buf, 0) == -1, "mlock zero length");
+  CHECK (mlock (kernel, PAGE_SIZE) == -1, "mlock kernel address");
+  CHECK (mlock (kernel - PAGE_SIZE, 2 * PAGE_SIZE) == -1,
+         "mlock range reaching into the kernel");
+  CHECK (munlock (buf + 1, PAGE_SIZE) == -1, "munlock misaligned address");
+  CHECK (munlock (buf, 0) == -1, "munlock zero length");
+  CHECK (munlock (kernel, PAGE_SIZE) == -1, "munlock kernel address");
+
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    buf[i] = 1;
+  CHECK (mlock (buf, sizeof buf) == -1, "mlock too many pages");
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0, "evict");
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    if (get_phys_addr (&buf[i]) != 0)
+      fail ("page %zu was left locked", i / PAGE_SIZE);
+  CHECK (mlock (buf, MLOCK_MAX * PAGE_SIZE) == 0, "mlock as many as allowed");
+  CHECK (mlock (buf + MLOCK_MAX * PAGE_SIZE, PAGE_SIZE) == -1,
+         "mlock one more");
+}
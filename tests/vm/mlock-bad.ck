@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlock-bad) begin
+(mlock-bad) mlock misaligned address
+(mlock-bad) mlock zero length
+(mlock-bad) mlock kernel address
+(mlock-bad) mlock range reaching into the kernel
+(mlock-bad) munlock misaligned address
+(mlock-bad) munlock zero length
+(mlock-bad) munlock kernel address
+(mlock-bad) mlock too many pages
+(mlock-bad) evict
+(mlock-bad) mlock as many as allowed
+(mlock-bad) mlock one more
+(mlock-bad) end
+mlock-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Locks a few pages in memory, then writes to far more memory
+   than there is, and checks that the locked pages stayed present
+   through it all and still hold what was written to them.  Runs
+   with 10 MB of memory. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define LOCKED_PAGES 16
+#define BIG_SIZE (16 * 1024 * 1024)
+
+static char locked[LOCKED_PAGES * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static char big[BIG_SIZE];
+
+/* Checks that each locked page is present and holds its byte. */
+static void
+check_locked (void)
+{
+  size_t i;
+
+  for (i = 0; i < LOCKED_PAGES; i++)
+    {
+      if (get_phys_addr (&locked[i * PAGE_SIZE]) == 0)
+        fail ("locked page %zu was evicted", i);
+      if (locked[i * PAGE_SIZE] != (char) (i + 1))
+        fail ("locked page %zu holds %d", i, locked[i * PAGE_SIZE]);
+    }
+}
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < LOCKED_PAGES; i++)
+    locked[i * PAGE_SIZE] = i + 1;
+  CHECK (mlock (locked, sizeof locked) == 0, "mlock");
+  check_locked ();
+
+  msg ("write over 16 MB");
+  for (i = 0; i < BIG_SIZE; i += PAGE_SIZE)
+    {
+      big[i] = i / PAGE_SIZE;
+      if (i % (4 * 1024 * 1024) == 0)
+        check_locked ();
+    }
+  msg ("read back 16 MB");
+  for (i = 0; i < BIG_SIZE; i += PAGE_SIZE)
+    if (big[i] != (char) (i / PAGE_SIZE))
+      fail ("page %zu of big holds %d", i / PAGE_SIZE, big[i]);
+  check_locked ();
+
+  CHECK (munlock (locked, sizeof locked) == 0, "munlock");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mlock-pressure) begin
+(mlock-pressure) mlock
+(mlock-pressure) write over 16 MB
+(mlock-pressure) read back 16 MB
+(mlock-pressure) munlock
+(mlock-pressure) end
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Checks that MADV_DONTNEED leaves a locked page alone, and that
+   it evicts the page again after munlock, part of the range at a
+   time. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 4
+
+static char buf[PAGE_COUNT * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    buf[i * PAGE_SIZE] = i + 1;
+  CHECK (mlock (buf, sizeof buf) == 0, "mlock");
+  CHECK (mlock (buf, sizeof buf) == 0, "mlock again");
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0, "evict");
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (get_phys_addr (&buf[i * PAGE_SIZE]) == 0)
+      fail ("locked page %zu was evicted", i);
+
+  CHECK (munlock (buf, 2 * PAGE_SIZE) == 0, "munlock first half");
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0, "evict");
+  for (i = 0; i < PAGE_COUNT; i++)
+    if ((get_phys_addr (&buf[i * PAGE_SIZE]) != 0) != (i >= 2))
+      fail ("page %zu is %s", i, i >= 2 ? "evicted" : "present");
+
+  CHECK (munlock (buf, sizeof buf) == 0, "munlock all");
+  CHECK (madvise (buf, sizeof buf, MADV_DONTNEED) == 0, "evict");
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (get_phys_addr (&buf[i * PAGE_SIZE]) != 0)
+      fail ("page %zu is present", i);
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) (i + 1))
+      fail ("page %zu holds %d", i, buf[i * PAGE_SIZE]);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlock-unlock) begin
+(mlock-unlock) mlock
+(mlock-unlock) mlock again
+(mlock-unlock) evict
+(mlock-unlock) munlock first half
+(mlock-unlock) evict
+(mlock-unlock) munlock all
+(mlock-unlock) evict
+(mlock-unlock) end
+mlock-unlock: exit(0)
+EOF
+pass;
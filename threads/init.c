@@ -2,6 +2,7 @@
 //Only on jin_hyuk branch
 #include "threads/init.h"
 #include <console.h>
+#include <ctype.h>
 #include <debug.h>
 #include <limits.h>
 #include <random.h>
@@ -22,7 +23,10 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/shrinker.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -33,6 +37,7 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/policy.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -40,6 +45,9 @@
 #include "filesys/fsutil.h"
 #endif
 
+/* CR0 bit that makes the kernel's writes obey read-only pages. */
+#define CR0_WP 0x00010000
+
 /* Page-map-level-4 with kernel mappings only. */
 uint64_t *base_pml4;
 
@@ -58,6 +66,10 @@ static void paging_init (uint64_t mem_end);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+#ifdef VM
+static size_t parse_count (const char *name, const char *value,
+		size_t min, size_t max);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -88,6 +100,7 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+	vmalloc_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -105,6 +118,7 @@ main (void) {
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
+	palloc_zero_init ();
 	serial_init_queue ();
 	timer_calibrate ();
 
@@ -142,9 +156,29 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns true if the CPU can map 1 GB pages with a PDPE. */
+static bool
+cpu_has_huge_pages (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (0x80000000, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000001)
+		return false;
+	cpuid (0x80000001, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 26)) != 0;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with the largest pages that fit:
+ * 1 GB pages where the CPU supports them, then 2 MB pages, and
+ * 4 kB pages only where a large page would straddle the end of
+ * memory or the boundary of the read-only kernel text.  A large
+ * page needs both its physical and its virtual address aligned;
+ * since KERN_BASE is not 1 GB-aligned, 1 GB pages are only used
+ * where the two happen to line up. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
@@ -152,21 +186,51 @@ paging_init (uint64_t mem_end) {
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = vtop (&start), text_end = vtop (&_end_kernel_text);
+	bool huge_ok = cpu_has_huge_pages ();
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0, size; pa < mem_end; pa += size) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (huge_ok && pa % HUGE_PGSIZE == 0 && va % HUGE_PGSIZE == 0
+				&& pa + HUGE_PGSIZE <= mem_end)
+			size = HUGE_PGSIZE;
+		else if (pa % LARGE_PGSIZE == 0 && va % LARGE_PGSIZE == 0
+				&& pa + LARGE_PGSIZE <= mem_end)
+			size = LARGE_PGSIZE;
+		else
+			size = PGSIZE;
+
+		/* Fall back to smaller pages until [pa, pa + size) is either
+		   entirely inside or entirely outside the kernel text. */
+		while (size > PGSIZE && pa < text_end && text_start < pa + size
+				&& (pa < text_start || text_end < pa + size))
+			size = size == HUGE_PGSIZE ? LARGE_PGSIZE : PGSIZE;
+
 		perm = PTE_P | PTE_W;
-		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
+		if (text_start <= pa && pa < text_end)
 			perm &= ~PTE_W;
 
-		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
+		if (size == PGSIZE)
+			pte = pml4e_walk (pml4, va, 1);
+		else {
+			pte = pml4e_walk_large (pml4, va, size, 1);
+			perm |= PTE_PS;
+		}
+		if (pte != NULL)
 			*pte = pa | perm;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_pcid_init ();
+
+	/* Make the kernel honor read-only mappings too, so that its
+	   writes to user pages shared copy-on-write fault like the
+	   user's own do. */
+	lcr0 (rcr0 () | CR0_WP);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -228,6 +292,30 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-vmpolicy")) {
+			if (!vm_policy_select (value))
+				PANIC ("unknown page replacement policy `%s'", value);
+		}
+		else if (!strcmp (name, "-faultaround"))
+			vm_fault_around_max = parse_count (name, value, 0, FAULT_AROUND_MAX);
+		else if (!strcmp (name, "-stackmax"))
+			vm_stack_max = parse_count (name, value, 1, STACK_PAGES_MAX);
+		else if (!strcmp (name, "-stackinit"))
+			vm_stack_initial = parse_count (name, value, 1, STACK_PAGES_MAX);
+		else if (!strcmp (name, "-ksm"))
+			vm_ksm_pages = parse_count (name, value, 1, KSM_PAGES_MAX);
+		else if (!strcmp (name, "-kswapd")) {
+			char *high = value != NULL ? strchr (value, ',') : NULL;
+
+			if (high != NULL)
+				*high++ = '\0';
+			vm_reclaim_low = parse_count (name, value, 1, RECLAIM_PAGES_MAX);
+			vm_reclaim_high = high != NULL
+				? parse_count (name, high, vm_reclaim_low, RECLAIM_PAGES_MAX)
+				: 2 * vm_reclaim_low;
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -236,6 +324,29 @@ parse_options (char **argv) {
 	return argv;
 }
 
+#ifdef VM
+/* Returns VALUE, the value given to option NAME, as a number from
+   MIN to MAX.  Panics if VALUE is missing, is not a decimal number
+   or is out of range. */
+static size_t
+parse_count (const char *name, const char *value, size_t min, size_t max) {
+	size_t n = 0;
+	const char *p;
+
+	if (value == NULL || *value == '\0')
+		PANIC ("option `%s' needs a value", name);
+	for (p = value; *p != '\0' && n <= max; p++) {
+		if (!isdigit (*p))
+			PANIC ("option `%s': `%s' is not a number", name, value);
+		n = n * 10 + (*p - '0');
+	}
+	if (n < min || n > max)
+		PANIC ("option `%s': %s is not between %zu and %zu",
+				name, value, min, max);
+	return n;
+}
+#endif
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv) {
@@ -330,6 +441,22 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -vmpolicy=NAME     Replace pages with NAME: clock (default),\n"
+			"                     2q, fifo or random.\n"
+			"  -faultaround=N     Map up to N pages after a faulting page\n"
+			"                     (default 16, 0 to disable, at most 512).\n"
+			"  -stackmax=N        Let user stacks grow to N pages (default 256,\n"
+			"                     at most all of user space).\n"
+			"  -stackinit=N       Start user stacks with N pages mapped\n"
+			"                     (default 4, at most -stackmax).\n"
+			"  -ksm=N             Merge identical anonymous pages, scanning\n"
+			"                     N frames every 100 ms, N from 1 to 4096\n"
+			"                     (default off).\n"
+			"  -kswapd=LOW[,HIGH] Evict in the background when fewer than LOW\n"
+			"                     user pages are free, until HIGH (at least\n"
+			"                     LOW, default 2*LOW) are (default off).\n"
 #endif
 			);
 	power_off ();
@@ -356,6 +483,9 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
+	shrinker_print_stats ();
+	pml4_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -364,4 +494,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
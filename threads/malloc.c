@@ -6,8 +6,10 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/shrinker.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
@@ -26,12 +28,17 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and keep the arena as a spare, up to MAX_SPARE_ARENAS per
+   descriptor, to be reused for the next new arena; beyond that,
+   it goes back to the page allocator.  Spare arenas are returned
+   to the page allocator under memory pressure by malloc's
+   shrinker.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
+   with the page allocator, or from the vmalloc region if no
+   contiguous run is free, and sticking the allocation size at
    the beginning of the allocated block's arena header. */
 
 /* Descriptor. */
@@ -39,9 +46,14 @@ struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
+	struct list spare_list;     /* List of empty arenas kept around. */
+	size_t spare_cnt;           /* Number of arenas in spare_list. */
 	struct lock lock;           /* Lock. */
 };
 
+/* Most empty arenas each descriptor keeps. */
+#define MAX_SPARE_ARENAS 16
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -57,6 +69,19 @@ struct block {
 	struct list_elem free_elem; /* Free list element. */
 };
 
+/* A spare arena's spare_list element is kept in its first block. */
+#define arena_spare_elem(A) (&arena_to_block (A, 0)->free_elem)
+
+static size_t malloc_shrink_count (struct shrinker *);
+static size_t malloc_shrink_scan (struct shrinker *, size_t nr_to_scan);
+
+/* Gives spare arenas back under memory pressure. */
+static struct shrinker malloc_shrinker = {
+	.name = "malloc",
+	.count = malloc_shrink_count,
+	.scan = malloc_shrink_scan,
+};
+
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
@@ -75,8 +100,11 @@ malloc_init (void) {
 		d->block_size = block_size;
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
+		list_init (&d->spare_list);
+		d->spare_cnt = 0;
 		lock_init (&d->lock);
 	}
+	shrinker_register (&malloc_shrinker);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -100,7 +128,7 @@ malloc (size_t size) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
+		a = vmalloc_pages (0, page_cnt);
 		if (a == NULL)
 			return NULL;
 
@@ -118,11 +146,20 @@ malloc (size_t size) {
 	if (list_empty (&d->free_list)) {
 		size_t i;
 
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
+		/* Reuse a spare arena, or allocate a page. */
+		if (!list_empty (&d->spare_list)) {
+			a = pg_round_down (list_pop_front (&d->spare_list));
+			d->spare_cnt--;
+		} else {
+			/* Let go of the descriptor while the page allocator runs,
+			   since it may call our shrinker. */
 			lock_release (&d->lock);
-			return NULL;
+			a = palloc_get_page (0);
+			lock_acquire (&d->lock);
+			if (a == NULL) {
+				lock_release (&d->lock);
+				return NULL;
+			}
 		}
 
 		/* Initialize arena and add its blocks to the free list. */
@@ -227,18 +264,54 @@ free (void *p) {
 					struct block *b = arena_to_block (a, i);
 					list_remove (&b->free_elem);
 				}
-				palloc_free_page (a);
+				if (d->spare_cnt < MAX_SPARE_ARENAS) {
+					list_push_front (&d->spare_list, arena_spare_elem (a));
+					d->spare_cnt++;
+				} else
+					palloc_free_page (a);
 			}
 
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
+			vfree_pages (a, a->free_cnt);
 			return;
 		}
 	}
 }
 
+/* Returns the number of spare arenas held by all descriptors.
+   Racy, but only used as an estimate. */
+static size_t
+malloc_shrink_count (struct shrinker *s UNUSED) {
+	size_t cnt = 0;
+	struct desc *d;
+
+	for (d = descs; d < descs + desc_cnt; d++)
+		cnt += d->spare_cnt;
+	return cnt;
+}
+
+/* Frees up to NR_TO_SCAN spare arenas, skipping descriptors whose
+   lock is held, since our caller may be holding it. */
+static size_t
+malloc_shrink_scan (struct shrinker *s UNUSED, size_t nr_to_scan) {
+	size_t freed = 0;
+	struct desc *d;
+
+	for (d = descs; d < descs + desc_cnt && freed < nr_to_scan; d++) {
+		if (!lock_try_acquire (&d->lock))
+			continue;
+		while (freed < nr_to_scan && !list_empty (&d->spare_list)) {
+			palloc_free_page (pg_round_down (list_pop_front (&d->spare_list)));
+			d->spare_cnt--;
+			freed++;
+		}
+		lock_release (&d->lock);
+	}
+	return freed;
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
@@ -1,18 +1,77 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+
+   When the CPU supports them, each pml4 is tagged with a PCID so
+   that its TLB entries survive switches to other address spaces.
+   A pml4's PCID is derived from its physical address; PCID 0
+   belongs to base_pml4.  pcid_owner[] records which pml4 last
+   used each PCID.  Loading a pml4 whose PCID is still owned by it
+   sets CR3_NOFLUSH and keeps the cached translations; otherwise
+   the PCID is recycled by taking ownership and loading CR3
+   without CR3_NOFLUSH, which flushes whatever the previous owner
+   left behind.  Forgetting the owner of a PCID is therefore
+   always enough to invalidate it. */
+#define PCID_CNT 4096                   /* Number of PCIDs. */
+#define CR3_NOFLUSH (1ULL << 63)        /* Keep TLB entries of the PCID. */
+#define CR4_PCIDE (1 << 17)             /* PCID enable. */
+
+static bool pcid_enabled;               /* CR4.PCIDE set? */
+static bool invpcid_enabled;            /* INVPCID available? */
+static uint64_t *pcid_owner[PCID_CNT];  /* pml4 that last used each PCID. */
+
+/* Statistics. */
+static long long cr3_loads;             /* Address space switches. */
+static long long cr3_noflush;           /* ...that kept the TLB. */
+
+/* Returns the PCID used for PML4. */
+static uint64_t
+pml4_pcid (uint64_t *pml4) {
+	if (pml4 == base_pml4)
+		return 0;
+	return pg_no (vtop (pml4)) % (PCID_CNT - 1) + 1;
+}
+
+/* Returns true if PML4 is the page table the CPU is using. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Makes sure the TLB holds no stale translation for virtual
+ * address VA in PML4, after its mapping has been changed. */
+static void
+pml4_flush_va (uint64_t *pml4, uint64_t va) {
+	if (pml4_is_active (pml4))
+		invlpg (va);
+	else if (pcid_enabled && pcid_owner[pml4_pcid (pml4)] == pml4) {
+		if (invpcid_enabled)
+			invpcid (0, pml4_pcid (pml4), va);
+		else
+			pcid_owner[pml4_pcid (pml4)] = NULL;
+	}
+}
+
+/* The walkers below stop at a PDE or PDPE that has PTE_PS set and
+ * return a pointer to it instead of to a PTE, since such an entry
+ * maps the page itself. */
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if ((uint64_t) pte & PTE_P && (uint64_t) pte & PTE_PS)
+			return &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -35,6 +94,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	int allocated = 0;
 	if (pdpe) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
+		if ((uint64_t) pde & PTE_P && (uint64_t) pde & PTE_PS)
+			return &pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -88,6 +149,59 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry (for SIZE ==
+ * LARGE_PGSIZE) or page directory pointer entry (for SIZE ==
+ * HUGE_PGSIZE) that would map a large page at virtual address VA
+ * in PML4E.  Missing tables above that entry are created if
+ * CREATE is true; otherwise a null pointer is returned for them.
+ * Also returns a null pointer if VA is already mapped at a finer
+ * granularity than SIZE. */
+uint64_t *
+pml4e_walk_large (uint64_t *pml4e, const uint64_t va, size_t size,
+		int create) {
+	uint64_t *table = pml4e;
+	int idx[] = { PML4 (va), PDPE (va) };
+	int depth = size == HUGE_PGSIZE ? 1 : 2;
+
+	ASSERT (size == LARGE_PGSIZE || size == HUGE_PGSIZE);
+	ASSERT (va % size == 0);
+
+	for (int i = 0; i < depth; i++) {
+		uint64_t *entry = &table[idx[i]];
+		if (!(*entry & PTE_P)) {
+			uint64_t *new_page;
+			if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+			*entry = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		} else if (*entry & PTE_PS)
+			return NULL;
+		table = ptov (PTE_ADDR (*entry));
+	}
+
+	uint64_t *leaf = &table[size == HUGE_PGSIZE ? PDPE (va) : PDX (va)];
+	if ((*leaf & PTE_P) && !(*leaf & PTE_PS))
+		return NULL;
+	return leaf;
+}
+
+/* Returns the size of the page mapped by the entry that
+ * pml4e_walk() returns for VA in PML4, or 0 if VA is unmapped. */
+static size_t
+leaf_size (uint64_t *pml4, const uint64_t va) {
+	uint64_t e = pml4[PML4 (va)];
+	if (!(e & PTE_P))
+		return 0;
+	e = ((uint64_t *) ptov (PTE_ADDR (e)))[PDPE (va)];
+	if (!(e & PTE_P))
+		return 0;
+	if (e & PTE_PS)
+		return HUGE_PGSIZE;
+	e = ((uint64_t *) ptov (PTE_ADDR (e)))[PDX (va)];
+	if (!(e & PTE_P))
+		return 0;
+	return e & PTE_PS ? LARGE_PGSIZE : PGSIZE;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +236,17 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -135,15 +256,23 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
+		if (((uint64_t) pde) & PTE_P) {
+			if (pdp[i] & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) i << PDPESHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
+		}
 	}
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * For a large mapping, FUNC is called once with the PDE or PDPE and
+ * the virtual address of the start of the large page. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,8 +298,13 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pte),
+						LARGE_PGSIZE / PGSIZE);
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -179,6 +313,8 @@ static void
 pdpe_destroy (uint64_t *pdpe) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
+		/* User memory is never mapped with 1 GB pages. */
+		ASSERT (!(pdpe[i] & PTE_P) || !(pdpe[i] & PTE_PS));
 		if (((uint64_t) pde) & PTE_P)
 			pgdir_destroy ((void *) PTE_ADDR (pde));
 	}
@@ -192,6 +328,14 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	/* Kernel threads may still be running on PML4 (see
+	 * process_activate()), and a future pml4 in the same page
+	 * must not inherit its PCID's translations. */
+	if (pml4_is_active (pml4))
+		pml4_activate (NULL);
+	if (pcid_enabled && pcid_owner[pml4_pcid (pml4)] == pml4)
+		pcid_owner[pml4_pcid (pml4)] = NULL;
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -199,11 +343,55 @@ pml4_destroy (uint64_t *pml4) {
 	palloc_free_page ((void *) pml4);
 }
 
+/* Enables PCIDs if the CPU supports them.  Must be called while
+ * base_pml4 is active. */
+void
+pml4_pcid_init (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (1, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1 << 17)))
+		return;
+	cpuid (0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 7) {
+		cpuid (7, &eax, &ebx, &ecx, &edx);
+		invpcid_enabled = (ebx & (1 << 10)) != 0;
+	}
+
+	ASSERT (pml4_is_active (base_pml4));
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_owner[0] = base_pml4;
+	pcid_enabled = true;
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  A null PML4 stands for base_pml4. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	cr3_loads++;
+
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4));
+		return;
+	}
+
+	uint64_t pcid = pml4_pcid (pml4);
+	if (pcid_owner[pcid] == pml4) {
+		cr3_noflush++;
+		lcr3 (vtop (pml4) | pcid | CR3_NOFLUSH);
+	} else {
+		pcid_owner[pcid] = pml4;
+		lcr3 (vtop (pml4) | pcid);
+	}
+}
+
+/* Prints statistics about address space switches. */
+void
+pml4_print_stats (void) {
+	printf ("TLB: %lld address space loads, %lld without flush (PCID %s)\n",
+			cr3_loads, cr3_noflush, pcid_enabled ? "on" : "off");
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +404,11 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	if (pte && (*pte & PTE_P)) {
+		size_t size = leaf_size (pml4, (uint64_t) uaddr);
+		return ptov (PTE_ADDR (*pte) & ~(size - 1))
+			+ ((uint64_t) uaddr & (size - 1));
+	}
 	return NULL;
 }
 
@@ -238,15 +429,45 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte && (*pte & PTE_PS))
+		return false;
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			pml4_flush_va (pml4, (uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
+/* Adds a 2 MB mapping in PML4 from user virtual address UPAGE to
+ * the physically contiguous frames starting at kernel virtual
+ * address KPAGE, which should come from palloc_get_large_page().
+ * Both must be aligned to LARGE_PGSIZE, and no part of the range
+ * may already be mapped with 4 kB pages.
+ * Returns true if successful, false if memory allocation failed
+ * or the range is already mapped. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT ((uint64_t) upage % LARGE_PGSIZE == 0);
+	ASSERT (vtop (kpage) % LARGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_large (pml4, (uint64_t) upage,
+			LARGE_PGSIZE, 1);
+
+	if (pde == NULL || (*pde & PTE_P))
+		return false;
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If UPAGE lies within a large
+ * mapping, the whole large page is marked not present. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
@@ -257,9 +478,70 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		pml4_flush_va (pml4, (uint64_t) upage);
+	}
+}
+
+/* Maps kernel virtual page KVA, which must lie outside the
+ * direct map and not be mapped yet, to the frame at kernel
+ * virtual address KPAGE.  Every pml4 shares base_pml4's kernel
+ * page tables, so the mapping appears in all address spaces.
+ * Returns true if successful, false if a page table could not
+ * be allocated. */
+bool
+pml4_set_kernel_page (void *kva, void *kpage) {
+	uint64_t *pte;
+
+	ASSERT (pg_ofs (kva) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (is_kernel_vaddr (kva));
+
+	pte = pml4e_walk (base_pml4, (uint64_t) kva, true);
+	if (pte == NULL)
+		return false;
+	ASSERT (!(*pte & PTE_P));
+	*pte = vtop (kpage) | PTE_P | PTE_W;
+	return true;
+}
+
+/* Removes the mapping of kernel virtual page KVA set up by
+ * pml4_set_kernel_page() and returns the frame it mapped, or a
+ * null pointer if KVA was not mapped.  The TLBs are not flushed;
+ * see pml4_flush_kernel(). */
+void *
+pml4_clear_kernel_page (void *kva) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) kva, false);
+	void *kpage;
+
+	if (pte == NULL || !(*pte & PTE_P))
+		return NULL;
+	kpage = ptov (PTE_ADDR (*pte));
+	*pte = 0;
+	return kpage;
+}
+
+/* Flushes the PAGE_CNT kernel virtual pages starting at KVA from
+ * the TLB of every address space, after their mappings have been
+ * removed.  Kernel mappings are not global, so under PCIDs stale
+ * copies may be cached for any PCID, not just the active one. */
+void
+pml4_flush_kernel (void *kva, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+
+	if (pcid_enabled && invpcid_enabled)
+		invpcid (2, 0, 0);
+	else {
+		for (size_t i = 0; i < page_cnt; i++)
+			invlpg ((uint64_t) kva + PGSIZE * i);
+
+		if (pcid_enabled) {
+			/* Every other PCID will be flushed when next used. */
+			uint64_t *active = ptov (PTE_ADDR (rcr3 ()));
+			memset (pcid_owner, 0, sizeof pcid_owner);
+			pcid_owner[pml4_pcid (active)] = active;
+		}
 	}
+	intr_set_level (old_level);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -283,8 +565,22 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_flush_va (pml4, (uint64_t) vpage);
+	}
+}
+
+/* Makes the PTE for virtual page VPAGE in PML4 writable if
+ * WRITABLE is true, read-only otherwise, keeping its other bits. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint32_t) PTE_W;
+
+		pml4_flush_va (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -309,7 +605,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_flush_va (pml4, (uint64_t) vpage);
 	}
 }
@@ -9,8 +9,13 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/loader.h"
+#include "threads/interrupt.h"
+#include "threads/pte.h"
+#include "threads/shrinker.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -23,16 +28,94 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool to start with.  The split is not fixed:
+   when one pool runs out, it borrows a run of free pages from
+   the other, so a kernel-heavy or a user-heavy workload can use
+   nearly all of memory.  The kernel pool never lends pages that
+   would leave it with fewer than KERNEL_RESERVE free pages, and
+   the user pool never grows past user_page_limit.  To make this
+   possible, both pools' bitmaps span all of memory, and
+   owner_map records which pool each page currently belongs to;
+   a page owned by one pool is always marked used in the other
+   pool's bitmap.
+
+   A request for several contiguous pages can fail even though
+   enough pages are free, if they are scattered.  Frames of user
+   memory can be moved, though, by whoever maps them.  Once that
+   code registers a mover with palloc_set_mover(), such requests
+   fall back to compaction: the allocator picks the run of user
+   pool pages that is cheapest to empty, has the mover relocate
+   each frame in it elsewhere, and hands out the emptied run.
+
+   Each pool also keeps a small reserve of free pages that are
+   known to contain only zeros, so that PAL_ZERO requests for a
+   single page do not have to clear it on the caller's critical
+   path.  Reserve pages are marked used in the pool's bitmap and
+   chained together through their first word, which is cleared
+   again when the page is handed out.  The "pzerod" thread runs
+   at the lowest priority and refills the reserves from pages
+   that have been freed, so the zeroing happens while the CPU
+   would otherwise be idle. */
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	void *zero_list;                /* Free pages known to be zeroed. */
+	size_t zero_cnt;                /* Number of pages in zero_list. */
+	size_t page_cnt;                /* Number of usable pages owned. */
+	size_t free_cnt;                /* Number of those that are free. */
+	size_t peak_used;               /* Most pages ever in use at once. */
+	long long borrowed;             /* Pages taken from the other pool. */
 };
 
+/* Pages of memory owned by the user pool.  Changes only while
+   holding both pools' locks. */
+static struct bitmap *owner_map;
+
+/* Free pages the kernel pool keeps for itself, as a fraction of
+   all usable pages. */
+#define KERNEL_RESERVE_DIV 16
+static size_t kernel_reserve;
+
+/* Pages that shrinkers are asked to free at a time. */
+#define SHRINK_BATCH 32
+
+/* Pages moved from one pool to the other at a time, if possible,
+   so that a pool that runs dry does not borrow page by page. */
+#define BORROW_PAGES 64
+
+/* Pool occupancy, sampled whenever pages change pools. */
+#define OCCUPANCY_SAMPLES 8
+struct occupancy {
+	int64_t tick;                   /* Timer tick of the sample. */
+	size_t kernel_used, kernel_cnt; /* Kernel pool pages used, owned. */
+	size_t user_used, user_cnt;     /* User pool pages used, owned. */
+};
+static struct occupancy samples[OCCUPANCY_SAMPLES];
+static size_t sample_cnt;           /* Samples ever taken. */
+
+/* Relocates user frames for compaction, if registered. */
+static palloc_move_func *page_mover;
+
+/* Compaction statistics. */
+static long long compact_runs;      /* Runs assembled. */
+static long long compact_moves;     /* Frames moved. */
+static long long compact_fails;     /* Attempts that failed. */
+
+/* Number of pre-zeroed pages to keep in each pool. */
+#define ZERO_RESERVE 32
+
+/* Wakes up the zeroing thread. */
+static struct semaphore zero_sema;
+static bool zero_pending;       /* Zeroing thread already woken? */
+static bool zero_started;       /* Zeroing thread running? */
+
+/* Statistics. */
+static long long zero_hits;     /* PAL_ZERO pages taken from a reserve. */
+static long long zero_misses;   /* PAL_ZERO pages cleared inline. */
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
@@ -41,7 +124,17 @@ size_t user_page_limit = SIZE_MAX;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
-static bool page_from_pool (const struct pool *, void *page);
+static struct pool *page_pool (void *page);
+static size_t pool_used (const struct pool *);
+static void pool_take (struct pool *, size_t page_cnt);
+static void pool_give (struct pool *, size_t page_cnt);
+static bool pool_borrow (struct pool *, size_t page_cnt);
+static void *pool_compact (struct pool *, size_t page_cnt);
+static bool low_on_memory (void);
+static void *zero_list_pop (struct pool *);
+static bool zero_list_drain (struct pool *);
+static void zero_wake (struct pool *);
+static void zero_thread (void *aux);
 
 /* multiboot info */
 struct multiboot_info {
@@ -133,6 +226,7 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 	enum { KERN_START, KERN, USER_START, USER } state = KERN_START;
 	uint64_t rem = kern_pages;
 	uint64_t region_start = 0, end = 0, start, size, size_in_pg;
+	uint64_t kern_start = 0;
 
 	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
 	struct e820_entry *entries = ptov (mb_info->mmap_base);
@@ -157,9 +251,8 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 						rem -= size_in_pg;
 						break;
 					}
-					// generate kernel pool
-					init_pool (&kernel_pool,
-							&free_start, region_start, start + rem * PGSIZE);
+					// the kernel pool starts here
+					kern_start = region_start;
 					// Transition to the next state
 					if (rem == size_in_pg) {
 						rem = user_pages;
@@ -187,14 +280,22 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 		}
 	}
 
-	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
+	// Both pools span from the kernel pool's start to the user
+	// pool's end.  The user pool initially owns [user_start, end).
+	uint64_t user_start = region_start;
+	size_t span_cnt = (end - kern_start) / PGSIZE;
+	size_t bm_size = DIV_ROUND_UP (bitmap_buf_size (span_cnt), PGSIZE) * PGSIZE;
+
+	init_pool (&kernel_pool, &free_start, kern_start, end);
+	init_pool (&user_pool, &free_start, kern_start, end);
+	owner_map = bitmap_create_in_buf (span_cnt, free_start, bm_size);
+	free_start += bm_size;
+	bitmap_set_all (owner_map, false);
+	bitmap_set_multiple (owner_map, pg_no (user_start) - pg_no (kern_start),
+			pg_no (end) - pg_no (user_start), true);
 
 	// Iterate over the e820_entry. Setup the usable.
 	uint64_t usable_bound = (uint64_t) free_start;
-	struct pool *pool;
-	void *pool_end;
-	size_t page_idx, page_cnt;
 
 	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
 		struct e820_entry *entry = &entries[i];
@@ -203,6 +304,7 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 				ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
 			uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
 			uint64_t end = start + size;
+			uint64_t mid;
 
 			// TODO: add 0x1000 ~ 0x200000, This is not a matter for now.
 			// All the pages are unuable
@@ -211,27 +313,28 @@ populate_pools (struct area *base_mem, struct area *ext_mem) {
 
 			start = (uint64_t)
 				pg_round_up (start >= usable_bound ? start : usable_bound);
-split:
-			if (page_from_pool (&kernel_pool, (void *) start))
-				pool = &kernel_pool;
-			else if (page_from_pool (&user_pool, (void *) start))
-				pool = &user_pool;
-			else
-				NOT_REACHED ();
-
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
-			page_idx = pg_no (start) - pg_no (pool->base);
-			if ((uint64_t) pool_end < end) {
-				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-				start = (uint64_t) pool_end;
-				goto split;
-			} else {
-				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-			}
+
+			// Pages below user_start go to the kernel pool, the rest
+			// to the user pool.
+			mid = start > user_start ? start : user_start;
+			mid = mid < end ? mid : end;
+			if (start < mid)
+				bitmap_set_multiple (kernel_pool.used_map,
+						pg_no (start) - pg_no (kern_start),
+						(mid - start) / PGSIZE, false);
+			if (mid < end)
+				bitmap_set_multiple (user_pool.used_map,
+						pg_no (mid) - pg_no (kern_start),
+						(end - mid) / PGSIZE, false);
 		}
 	}
+
+	kernel_pool.page_cnt = kernel_pool.free_cnt
+		= bitmap_count (kernel_pool.used_map, 0, span_cnt, false);
+	user_pool.page_cnt = user_pool.free_cnt
+		= bitmap_count (user_pool.used_map, 0, span_cnt, false);
+	kernel_reserve = (kernel_pool.page_cnt + user_pool.page_cnt)
+		/ KERNEL_RESERVE_DIV;
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -253,6 +356,37 @@ palloc_init (void) {
 	return ext_mem.end;
 }
 
+/* Takes PAGE_CNT contiguous free pages from POOL, preferring its
+   zero reserve for a single PAL_ZERO page, and sets *ZEROED to
+   whether they came from there.  Returns a null pointer if POOL
+   has no such run. */
+static void *
+take_pages (struct pool *pool, enum palloc_flags flags, size_t page_cnt,
+		bool *zeroed) {
+	void *pages = NULL;
+	size_t page_idx;
+
+	lock_acquire (&pool->lock);
+	if ((flags & PAL_ZERO) && page_cnt == 1) {
+		pages = zero_list_pop (pool);
+		*zeroed = pages != NULL;
+	}
+	if (pages == NULL) {
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+
+		/* The reserve may be holding the pages we need. */
+		if (page_idx == BITMAP_ERROR && zero_list_drain (pool))
+			page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+
+		if (page_idx != BITMAP_ERROR) {
+			pages = pool->base + PGSIZE * page_idx;
+			pool_take (pool, page_cnt);
+		}
+	}
+	lock_release (&pool->lock);
+	return pages;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -262,20 +396,42 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	void *pages = NULL;
+	bool zeroed = false;
+	int round;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
+	/* Below the low watermark, make caches give memory back before
+	   it runs out altogether. */
+	if (low_on_memory ())
+		shrink_caches (SHRINK_BATCH);
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	for (round = 0; pages == NULL && round < 2; round++) {
+		/* Before trying again, have caches free what they can. */
+		if (round > 0
+				&& shrink_caches (page_cnt > SHRINK_BATCH ? page_cnt : SHRINK_BATCH)
+				== 0)
+			break;
+
+		pages = take_pages (pool, flags, page_cnt, &zeroed);
+
+		/* Out of pages: take some from the other pool. */
+		if (pages == NULL && pool_borrow (pool, page_cnt))
+			pages = take_pages (pool, flags, page_cnt, &zeroed);
+
+		/* Enough pages may be free, just not in one piece. */
+		if (pages == NULL && page_cnt > 1)
+			pages = pool_compact (pool, page_cnt);
+	}
 
 	if (pages) {
-		if (flags & PAL_ZERO)
-			memset (pages, 0, PGSIZE * page_cnt);
+		if (zeroed) {
+			zero_hits++;
+			zero_wake (pool);
+		} else if (flags & PAL_ZERO) {
+			zero_misses++;
+			for (size_t i = 0; i < page_cnt; i++)
+				clear_page (pages + PGSIZE * i);
+		}
 	} else {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
@@ -284,6 +440,43 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Obtains LARGE_PGSIZE / PGSIZE contiguous free pages whose
+   physical address is aligned to LARGE_PGSIZE, suitable for a
+   2 MB mapping with pml4_set_large_page().  FLAGS are interpreted
+   as for palloc_get_multiple().  Free the pages with
+   palloc_free_multiple(). */
+void *
+palloc_get_large_page (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	const size_t page_cnt = LARGE_PGSIZE / PGSIZE;
+	size_t pool_cnt = bitmap_size (pool->used_map);
+	size_t page_idx = (ROUND_UP (vtop (pool->base), LARGE_PGSIZE)
+			- vtop (pool->base)) / PGSIZE;
+	void *pages = NULL;
+
+	lock_acquire (&pool->lock);
+	for (int pass = 0; pass < 2 && pages == NULL; pass++) {
+		/* On the second pass, let the zero reserve go. */
+		if (pass == 1 && !zero_list_drain (pool))
+			break;
+		for (size_t i = page_idx; i + page_cnt <= pool_cnt; i += page_cnt)
+			if (bitmap_none (pool->used_map, i, page_cnt)) {
+				bitmap_set_multiple (pool->used_map, i, page_cnt, true);
+				pool_take (pool, page_cnt);
+				pages = pool->base + PGSIZE * i;
+				break;
+			}
+	}
+	lock_release (&pool->lock);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, LARGE_PGSIZE);
+	} else if (flags & PAL_ASSERT)
+		PANIC ("palloc_get_large_page: out of pages");
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -306,13 +499,7 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	if (pages == NULL || page_cnt == 0)
 		return;
 
-	if (page_from_pool (&kernel_pool, pages))
-		pool = &kernel_pool;
-	else if (page_from_pool (&user_pool, pages))
-		pool = &user_pool;
-	else
-		NOT_REACHED ();
-
+	pool = page_pool (pages);
 	page_idx = pg_no (pages) - pg_no (pool->base);
 
 #ifndef NDEBUG
@@ -320,6 +507,8 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool_give (pool, page_cnt);
+	zero_wake (pool);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +517,41 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of pages that user requests could still get
+   without anything being freed: the user pool's free pages, and
+   those it may borrow from the kernel pool.  Reads the counters
+   without locking, so the answer is only an estimate. */
+size_t
+palloc_user_free (void) {
+	size_t kernel_free = kernel_pool.free_cnt + kernel_pool.zero_cnt;
+	size_t spare = kernel_free > kernel_reserve ? kernel_free - kernel_reserve : 0;
+	size_t room = user_page_limit > user_pool.page_cnt
+		? user_page_limit - user_pool.page_cnt : 0;
+
+	return user_pool.free_cnt + user_pool.zero_cnt + (spare < room ? spare : room);
+}
+
+/* Fills the page at PAGE with zeros.  Pages are aligned and a
+   whole number of words long, so a single REP STOSQ does. */
+void
+clear_page (void *page) {
+	size_t cnt = PGSIZE / sizeof (uint64_t);
+
+	ASSERT (pg_ofs (page) == 0);
+	__asm __volatile ("rep stosq"
+			: "+D" (page), "+c" (cnt) : "a" (0) : "memory");
+}
+
+/* Copies the page at SRC to the page at DST. */
+void
+copy_page (void *dst, const void *src) {
+	size_t cnt = PGSIZE / sizeof (uint64_t);
+
+	ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+	__asm __volatile ("rep movsq"
+			: "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -340,6 +564,10 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->zero_list = NULL;
+	p->zero_cnt = 0;
+	p->page_cnt = p->free_cnt = p->peak_used = 0;
+	p->borrowed = 0;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
@@ -347,12 +575,488 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	*bm_base += bm_pages;
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+/* Returns the pool that PAGE belongs to.  An allocated page
+   never changes pools, so no lock is needed. */
+static struct pool *
+page_pool (void *page) {
+	size_t page_idx = pg_no (page) - pg_no (kernel_pool.base);
+
+	ASSERT (page_idx < bitmap_size (owner_map));
+	return bitmap_test (owner_map, page_idx) ? &user_pool : &kernel_pool;
+}
+
+/* Returns true if free memory is below the low watermark, that
+   is, the kernel has started eating into its reserve. */
+static bool
+low_on_memory (void) {
+	return kernel_pool.free_cnt + user_pool.free_cnt < kernel_reserve;
+}
+
+/* Returns the number of pages of POOL in use, not counting its
+   zero reserve. */
+static size_t
+pool_used (const struct pool *pool) {
+	return pool->page_cnt - pool->free_cnt - pool->zero_cnt;
+}
+
+/* Accounts for PAGE_CNT free pages of POOL having been marked
+   used.  The counters are also updated by palloc_free_multiple(),
+   which does not take POOL's lock because it may run with
+   interrupts off, so they are updated with interrupts off. */
+static void
+pool_take (struct pool *pool, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (pool->free_cnt >= page_cnt);
+	pool->free_cnt -= page_cnt;
+	if (pool_used (pool) > pool->peak_used)
+		pool->peak_used = pool_used (pool);
+	intr_set_level (old_level);
+}
+
+/* Accounts for PAGE_CNT pages of POOL having been marked free. */
+static void
+pool_give (struct pool *pool, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+
+	pool->free_cnt += page_cnt;
+	intr_set_level (old_level);
+}
+
+/* Records the occupancy of both pools. */
+static void
+sample_occupancy (void) {
+	struct occupancy *o = &samples[sample_cnt++ % OCCUPANCY_SAMPLES];
+
+	o->tick = timer_ticks ();
+	o->kernel_used = pool_used (&kernel_pool);
+	o->kernel_cnt = kernel_pool.page_cnt;
+	o->user_used = pool_used (&user_pool);
+	o->user_cnt = user_pool.page_cnt;
+}
+
+/* Moves a run of free pages from FROM to TO, trying BORROW_PAGES
+   first and then just PAGE_CNT.  Both locks must be held.
+   Returns true if successful. */
 static bool
-page_from_pool (const struct pool *pool, void *page) {
-	size_t page_no = pg_no (page);
-	size_t start_page = pg_no (pool->base);
-	size_t end_page = start_page + bitmap_size (pool->used_map);
-	return page_no >= start_page && page_no < end_page;
+move_pages (struct pool *from, struct pool *to, size_t page_cnt) {
+	size_t cnt = page_cnt > BORROW_PAGES ? page_cnt : BORROW_PAGES;
+
+	for (;; cnt = page_cnt) {
+		size_t page_idx;
+
+		/* Respect the kernel reserve and the user page limit. */
+		if ((from != &kernel_pool || from->free_cnt >= cnt + kernel_reserve)
+				&& (to != &user_pool || to->page_cnt + cnt <= user_page_limit)) {
+			page_idx = bitmap_scan (from->used_map, 0, cnt, false);
+			if (page_idx != BITMAP_ERROR) {
+				bitmap_set_multiple (from->used_map, page_idx, cnt, true);
+				bitmap_set_multiple (owner_map, page_idx, cnt, to == &user_pool);
+				bitmap_set_multiple (to->used_map, page_idx, cnt, false);
+				pool_take (from, cnt);
+				from->page_cnt -= cnt;
+				to->page_cnt += cnt;
+				pool_give (to, cnt);
+				to->borrowed += cnt;
+				return true;
+			}
+		}
+		if (cnt == page_cnt)
+			return false;
+	}
+}
+
+/* Moves free pages from the other pool into POOL, so that POOL
+   can satisfy a request for PAGE_CNT contiguous pages.  POOL's
+   lock must not be held.  Returns true if successful. */
+static bool
+pool_borrow (struct pool *pool, size_t page_cnt) {
+	struct pool *from = pool == &user_pool ? &kernel_pool : &user_pool;
+	bool moved;
+
+	/* Always lock the kernel pool first. */
+	lock_acquire (&kernel_pool.lock);
+	lock_acquire (&user_pool.lock);
+	moved = move_pages (from, pool, page_cnt);
+	if (!moved && zero_list_drain (from))
+		moved = move_pages (from, pool, page_cnt);
+	if (moved)
+		sample_occupancy ();
+	lock_release (&user_pool.lock);
+	lock_release (&kernel_pool.lock);
+	return moved;
+}
+
+/* Registers MOVER to relocate frames of the user pool during
+   compaction.  MOVER(OLD, NEW) must copy the frame at OLD to NEW,
+   redirect every mapping of OLD to NEW, and return true, or
+   return false without changing anything if OLD cannot be moved
+   right now.  It is called without any pool lock held. */
+void
+palloc_set_mover (palloc_move_func *mover) {
+	page_mover = mover;
+}
+
+/* Returns the index of a free page of the user pool outside
+   [START, START + CNT) and marks it used, or BITMAP_ERROR if
+   there is none.  The user pool's lock must be held. */
+static size_t
+take_page_outside (size_t start, size_t cnt) {
+	struct bitmap *map = user_pool.used_map;
+	size_t page_idx;
+
+	page_idx = bitmap_scan (map, start + cnt, 1, false);
+	if (page_idx == BITMAP_ERROR) {
+		page_idx = bitmap_scan (map, 0, 1, false);
+		if (page_idx >= start)
+			return BITMAP_ERROR;
+	}
+	bitmap_mark (map, page_idx);
+	pool_take (&user_pool, 1);
+	return page_idx;
+}
+
+/* Finds the run of PAGE_CNT pages owned by the user pool with the
+   fewest pages in use, moves each of those elsewhere, and returns
+   the run, marked used.  Returns a null pointer if no mover is
+   registered, no such run can be emptied, or a frame in it
+   cannot be moved. */
+static void *
+compact_user_run (size_t page_cnt) {
+	struct pool *pool = &user_pool;
+	size_t span = bitmap_size (owner_map);
+	size_t start = BITMAP_ERROR, best_used = SIZE_MAX;
+	size_t used = 0, foreign = 0;
+	void *pages = NULL;
+	size_t i;
+
+	if (page_mover == NULL || page_cnt > span)
+		return NULL;
+
+	/* Slide a window of PAGE_CNT pages over the pool, counting
+	   used pages and pages owned by the kernel pool in it. */
+	lock_acquire (&pool->lock);
+	zero_list_drain (pool);
+	for (i = 0; i < span; i++) {
+		if (!bitmap_test (owner_map, i))
+			foreign++;
+		else if (bitmap_test (pool->used_map, i))
+			used++;
+		if (i >= page_cnt) {
+			size_t j = i - page_cnt;
+			if (!bitmap_test (owner_map, j))
+				foreign--;
+			else if (bitmap_test (pool->used_map, j))
+				used--;
+		}
+		if (i + 1 >= page_cnt && foreign == 0 && used < best_used) {
+			start = i + 1 - page_cnt;
+			best_used = used;
+		}
+	}
+
+	/* The BEST_USED frames must fit in the free pages outside the
+	   run, of which there are FREE_CNT - (PAGE_CNT - BEST_USED). */
+	if (start == BITMAP_ERROR || pool->free_cnt < page_cnt) {
+		lock_release (&pool->lock);
+		compact_fails++;
+		return NULL;
+	}
+	lock_release (&pool->lock);
+
+	/* Move the frames out one by one.  Pages freed or allocated
+	   concurrently are rechecked at the end. */
+	for (i = start; i < start + page_cnt; i++) {
+		size_t dst_idx;
+		void *src, *dst;
+
+		lock_acquire (&pool->lock);
+		if (!bitmap_test (pool->used_map, i)) {
+			lock_release (&pool->lock);
+			continue;
+		}
+		dst_idx = take_page_outside (start, page_cnt);
+		lock_release (&pool->lock);
+		if (dst_idx == BITMAP_ERROR)
+			break;
+
+		src = pool->base + PGSIZE * i;
+		dst = pool->base + PGSIZE * dst_idx;
+		if (!page_mover (src, dst)) {
+			palloc_free_page (dst);
+			break;
+		}
+		compact_moves++;
+		palloc_free_page (src);
+	}
+
+	/* Claim the run if it is entirely free now. */
+	lock_acquire (&pool->lock);
+	if (i == start + page_cnt
+			&& bitmap_none (pool->used_map, start, page_cnt)
+			&& bitmap_all (owner_map, start, page_cnt)) {
+		bitmap_set_multiple (pool->used_map, start, page_cnt, true);
+		pool_take (pool, page_cnt);
+		pages = pool->base + PGSIZE * start;
+	}
+	lock_release (&pool->lock);
+
+	if (pages != NULL)
+		compact_runs++;
+	else
+		compact_fails++;
+	return pages;
+}
+
+/* Compacts the user pool to satisfy a request from POOL for
+   PAGE_CNT contiguous pages.  The run is handed to the kernel
+   pool if that is the one asking.  POOL's lock must not be held.
+   Returns the pages, marked used in POOL, or a null pointer. */
+static void *
+pool_compact (struct pool *pool, size_t page_cnt) {
+	void *pages = compact_user_run (page_cnt);
+	size_t page_idx;
+
+	if (pages == NULL || pool == &user_pool)
+		return pages;
+
+	/* A page owned by the user pool is already marked used in the
+	   kernel pool's bitmap, so only the owner changes. */
+	page_idx = pg_no (pages) - pg_no (pool->base);
+	lock_acquire (&kernel_pool.lock);
+	lock_acquire (&user_pool.lock);
+	bitmap_set_multiple (owner_map, page_idx, page_cnt, false);
+	user_pool.page_cnt -= page_cnt;
+	kernel_pool.page_cnt += page_cnt;
+	kernel_pool.borrowed += page_cnt;
+	pool_take (&kernel_pool, 0);        /* Updates the peak. */
+	sample_occupancy ();
+	lock_release (&user_pool.lock);
+	lock_release (&kernel_pool.lock);
+	return pages;
+}
+
+/* Prints how fragmented POOL's free pages are: how many free
+   runs they form, the longest run, and, for requests of 8, 64
+   and 512 pages, the fraction of free pages (in thousandths) in
+   runs too short to satisfy them. */
+static void
+print_fragmentation (const char *name, struct pool *pool) {
+	static const size_t sizes[] = { 8, 64, 512 };
+	size_t unusable[3] = { 0, 0, 0 };
+	size_t span = bitmap_size (pool->used_map);
+	size_t free_cnt = 0, run_cnt = 0, longest = 0;
+	size_t i, k;
+
+	lock_acquire (&pool->lock);
+	for (i = 0; i < span; ) {
+		size_t run;
+
+		if (bitmap_test (pool->used_map, i)) {
+			i++;
+			continue;
+		}
+		for (run = 0; i + run < span && !bitmap_test (pool->used_map, i + run);
+				run++)
+			continue;
+		free_cnt += run;
+		run_cnt++;
+		if (run > longest)
+			longest = run;
+		for (k = 0; k < 3; k++)
+			if (run < sizes[k])
+				unusable[k] += run;
+		i += run;
+	}
+	lock_release (&pool->lock);
+
+	printf ("Palloc: %s pool: %zu free pages in %zu runs, longest %zu; "
+			"fragmentation %zu/%zu/%zu at 8/64/512 pages\n", name,
+			free_cnt, run_cnt, longest,
+			free_cnt ? unusable[0] * 1000 / free_cnt : 0,
+			free_cnt ? unusable[1] * 1000 / free_cnt : 0,
+			free_cnt ? unusable[2] * 1000 / free_cnt : 0);
+}
+
+/* Takes a page off POOL's zero reserve and returns it, or returns
+   a null pointer if the reserve is empty.  POOL's lock must be
+   held. */
+static void *
+zero_list_pop (struct pool *pool) {
+	void **page = pool->zero_list;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+	if (page == NULL)
+		return NULL;
+
+	/* The link is the only non-zero word in the page. */
+	pool->zero_list = *page;
+	pool->zero_cnt--;
+	*page = NULL;
+	return page;
+}
+
+/* Gives every page in POOL's zero reserve back to the bitmap, so
+   that they can be part of a multi-page or non-zeroed request.
+   Returns true if any page was returned.  POOL's lock must be
+   held. */
+static bool
+zero_list_drain (struct pool *pool) {
+	bool drained = pool->zero_list != NULL;
+	void *page;
+
+	while ((page = zero_list_pop (pool)) != NULL) {
+		bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+		pool_give (pool, 1);
+	}
+	return drained;
+}
+
+/* Wakes up the zeroing thread if POOL's reserve is below its
+   target.  Never blocks, and does nothing when called with
+   interrupts off (e.g. from the scheduler), since waking a
+   thread there could preempt the caller. */
+static void
+zero_wake (struct pool *pool) {
+	enum intr_level old_level;
+
+	if (!zero_started || pool->zero_cnt >= ZERO_RESERVE
+			|| intr_context () || intr_get_level () == INTR_OFF)
+		return;
+
+	old_level = intr_disable ();
+	if (!zero_pending) {
+		zero_pending = true;
+		sema_up (&zero_sema);
+	}
+	intr_set_level (old_level);
+}
+
+/* Clears one free page of POOL and adds it to POOL's reserve.
+   Returns false if the reserve is full or POOL has no free
+   pages left to clear. */
+static bool
+zero_one (struct pool *pool) {
+	size_t page_idx;
+	void **page;
+
+	/* Under memory pressure, free pages are worth more than
+	   zeroed ones. */
+	if (low_on_memory ())
+		return false;
+
+	lock_acquire (&pool->lock);
+	page_idx = pool->zero_cnt < ZERO_RESERVE
+		? bitmap_scan_and_flip (pool->used_map, 0, 1, false)
+		: BITMAP_ERROR;
+	if (page_idx != BITMAP_ERROR)
+		pool_take (pool, 1);
+	lock_release (&pool->lock);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	/* The page is ours now, so clear it without holding the lock. */
+	page = (void **) (pool->base + PGSIZE * page_idx);
+	clear_page (page);
+
+	lock_acquire (&pool->lock);
+	*page = pool->zero_list;
+	pool->zero_list = page;
+	pool->zero_cnt++;
+	lock_release (&pool->lock);
+	return true;
+}
+
+/* Zeroing thread.  Refills the reserves of both pools, then sleeps
+   until pages are freed or taken from a reserve. */
+static void
+zero_thread (void *aux UNUSED) {
+	if (thread_mlfqs)
+		thread_set_nice (20);
+
+	for (;;) {
+		while (zero_one (&kernel_pool) | zero_one (&user_pool))
+			continue;
+
+		intr_disable ();
+		zero_pending = false;
+		intr_enable ();
+		sema_down (&zero_sema);
+	}
+}
+
+/* Returns the number of pages in both zero reserves. */
+static size_t
+zero_shrink_count (struct shrinker *s UNUSED) {
+	return kernel_pool.zero_cnt + user_pool.zero_cnt;
+}
+
+/* Returns up to NR_TO_SCAN reserve pages to their pools' bitmaps,
+   skipping a pool whose lock is held. */
+static size_t
+zero_shrink_scan (struct shrinker *s UNUSED, size_t nr_to_scan) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+	size_t freed = 0;
+
+	for (int i = 0; i < 2; i++) {
+		struct pool *pool = pools[i];
+		void *page;
+
+		if (!lock_try_acquire (&pool->lock))
+			continue;
+		while (freed < nr_to_scan && (page = zero_list_pop (pool)) != NULL) {
+			bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+			pool_give (pool, 1);
+			freed++;
+		}
+		lock_release (&pool->lock);
+	}
+	return freed;
+}
+
+/* Gives the zero reserves back under memory pressure. */
+static struct shrinker zero_shrinker = {
+	.name = "zero reserve",
+	.count = zero_shrink_count,
+	.scan = zero_shrink_scan,
+};
+
+/* Starts the thread that keeps the zeroed page reserves filled.
+   Must be called after thread_start(). */
+void
+palloc_zero_init (void) {
+	sema_init (&zero_sema, 0);
+	zero_pending = true;
+	zero_started = true;
+	shrinker_register (&zero_shrinker);
+	thread_create ("pzerod", PRI_MIN, zero_thread, NULL);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	size_t i;
+
+	printf ("Palloc: %lld zeroed pages from reserve, %lld zeroed inline\n",
+			zero_hits, zero_misses);
+	printf ("Palloc: kernel pool %zu of %zu pages used (peak %zu), "
+			"%lld borrowed\n", pool_used (&kernel_pool), kernel_pool.page_cnt,
+			kernel_pool.peak_used, kernel_pool.borrowed);
+	printf ("Palloc: user pool %zu of %zu pages used (peak %zu), "
+			"%lld borrowed\n", pool_used (&user_pool), user_pool.page_cnt,
+			user_pool.peak_used, user_pool.borrowed);
+
+	print_fragmentation ("kernel", &kernel_pool);
+	print_fragmentation ("user", &user_pool);
+	printf ("Palloc: compaction assembled %lld runs, moved %lld frames, "
+			"failed %lld times\n", compact_runs, compact_moves, compact_fails);
+
+	/* Occupancy whenever the split changed, oldest first. */
+	i = sample_cnt > OCCUPANCY_SAMPLES ? sample_cnt - OCCUPANCY_SAMPLES : 0;
+	for (; i < sample_cnt; i++) {
+		struct occupancy *o = &samples[i % OCCUPANCY_SAMPLES];
+		printf ("Palloc: tick %lld: kernel %zu/%zu, user %zu/%zu\n",
+				(long long) o->tick, o->kernel_used, o->kernel_cnt,
+				o->user_used, o->user_cnt);
+	}
 }
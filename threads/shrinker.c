@@ -0,0 +1,114 @@
+#include "threads/shrinker.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+/* Shrinker registry.
+
+   Kernel caches that hold on to memory they could do without
+   register a shrinker.  When the page allocator runs low, it
+   calls shrink_caches(), which asks every cache to free pages in
+   proportion to how many it could free.  Only one thread shrinks
+   at a time; others needing memory meanwhile just fail, as they
+   would without shrinkers.
+
+   The list is only changed and walked with interrupts off, so
+   that no lock is needed inside the page allocator. */
+
+static struct list shrinkers;
+static bool shrinkers_initialized;
+static bool shrinking;              /* A thread is in shrink_caches(). */
+
+/* Statistics. */
+static long long shrink_calls;      /* Calls to shrink_caches(). */
+
+/* Adds S to the shrinkers called under memory pressure. */
+void
+shrinker_register (struct shrinker *s) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (s->count != NULL && s->scan != NULL);
+	if (!shrinkers_initialized) {
+		list_init (&shrinkers);
+		shrinkers_initialized = true;
+	}
+	s->freed = 0;
+	list_push_back (&shrinkers, &s->elem);
+	intr_set_level (old_level);
+}
+
+/* Removes S from the shrinkers.  Must not be called while S is
+   being scanned. */
+void
+shrinker_unregister (struct shrinker *s) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (!shrinking);
+	list_remove (&s->elem);
+	intr_set_level (old_level);
+}
+
+/* Asks the registered caches to free PAGE_CNT pages in all, each
+   in proportion to the pages it holds.  Returns the number of
+   pages actually freed. */
+size_t
+shrink_caches (size_t page_cnt) {
+	enum intr_level old_level;
+	struct list_elem *e;
+	size_t total = 0, freed = 0;
+
+	old_level = intr_disable ();
+	if (shrinking || !shrinkers_initialized) {
+		intr_set_level (old_level);
+		return 0;
+	}
+	shrinking = true;
+	shrink_calls++;
+	intr_set_level (old_level);
+
+	/* The list cannot change while SHRINKING is set, except by
+	   shrinker_register(), which only appends. */
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+			e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		total += s->count (s);
+	}
+
+	if (total > 0)
+		for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+				e = list_next (e)) {
+			struct shrinker *s = list_entry (e, struct shrinker, elem);
+			size_t cnt = s->count (s);
+			size_t nr;
+
+			if (cnt == 0)
+				continue;
+			nr = DIV_ROUND_UP (page_cnt * cnt, total);
+			nr = s->scan (s, nr < cnt ? nr : cnt);
+			s->freed += nr;
+			freed += nr;
+		}
+
+	old_level = intr_disable ();
+	shrinking = false;
+	intr_set_level (old_level);
+	return freed;
+}
+
+/* Prints shrinker statistics. */
+void
+shrinker_print_stats (void) {
+	struct list_elem *e;
+
+	if (!shrinkers_initialized)
+		return;
+	printf ("Shrinkers: called %lld times", shrink_calls);
+	for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+			e = list_next (e)) {
+		struct shrinker *s = list_entry (e, struct shrinker, elem);
+		printf (", %s freed %lld pages", s->name, s->freed);
+	}
+	printf ("\n");
+}
@@ -8,6 +8,7 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/vmalloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
@@ -221,7 +222,7 @@ tid_t thread_create(const char *name, int priority,
 
 	list_push_back(&((*(thread_current())).childThreadList),&((*(t)).childThreadElem));
 
-    	(*(t)).fdTable = palloc_get_multiple(PAL_ZERO, 3);
+    	(*(t)).fdTable = vmalloc_pages(PAL_ZERO, 3);
 
     	if ((*(t)).fdTable == NULL)
         	return TID_ERROR;
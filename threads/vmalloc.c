@@ -0,0 +1,152 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtually contiguous kernel allocations.
+
+   palloc_get_multiple() needs a run of physically contiguous
+   free pages, which fragmentation can make unavailable long
+   before memory runs out.  vmalloc() instead takes pages from
+   the kernel pool one at a time and maps them at consecutive
+   addresses in the vmalloc region, through base_pml4's kernel
+   page tables, which every address space shares.
+
+   Each allocation is followed by one unmapped guard page in the
+   region.  Besides catching overruns, the guard page marks the
+   end of the allocation, so vfree() needs no size. */
+
+/* Number of pages in the vmalloc region. */
+#define VMALLOC_PAGES ((VMALLOC_END - VMALLOC_START) / PGSIZE)
+
+static struct bitmap *used_map;     /* Pages of the region in use. */
+static struct lock vmalloc_lock;    /* Protects used_map and mappings. */
+
+/* Initializes the vmalloc region.  Until this is called,
+   vmalloc() fails and vmalloc_pages() uses the page allocator
+   alone. */
+void
+vmalloc_init (void) {
+	lock_init (&vmalloc_lock);
+	used_map = bitmap_create (VMALLOC_PAGES);
+	if (used_map == NULL)
+		PANIC ("vmalloc_init: no memory for region bitmap");
+}
+
+/* Unmaps the PAGE_CNT pages starting at KVA and frees the frames
+   behind them.  The caller must hold vmalloc_lock. */
+static void
+unmap_pages (uint8_t *kva, size_t page_cnt) {
+	for (size_t i = 0; i < page_cnt; i++) {
+		void *kpage = pml4_clear_kernel_page (kva + PGSIZE * i);
+		ASSERT (kpage != NULL);
+		palloc_free_page (kpage);
+	}
+	pml4_flush_kernel (kva, page_cnt);
+}
+
+/* Obtains SIZE bytes of virtually contiguous kernel memory,
+   backed by pages that need not be physically contiguous, and
+   returns its page-aligned address.  Returns a null pointer if
+   the region or the kernel pool is exhausted. */
+void *
+vmalloc (size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	size_t page_idx;
+	uint8_t *kva;
+	size_t i;
+
+	if (page_cnt == 0 || used_map == NULL)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+	page_idx = bitmap_scan_and_flip (used_map, 0, page_cnt + 1, false);
+	if (page_idx == BITMAP_ERROR) {
+		lock_release (&vmalloc_lock);
+		return NULL;
+	}
+
+	kva = (uint8_t *) VMALLOC_START + PGSIZE * page_idx;
+	for (i = 0; i < page_cnt; i++) {
+		void *kpage = palloc_get_page (0);
+		if (kpage == NULL)
+			break;
+		if (!pml4_set_kernel_page (kva + PGSIZE * i, kpage)) {
+			palloc_free_page (kpage);
+			break;
+		}
+	}
+	if (i < page_cnt) {
+		unmap_pages (kva, i);
+		bitmap_set_multiple (used_map, page_idx, page_cnt + 1, false);
+		kva = NULL;
+	}
+	lock_release (&vmalloc_lock);
+	return kva;
+}
+
+/* Frees the allocation at KVA, which must have been returned by
+   vmalloc().  A null pointer is ignored. */
+void
+vfree (void *kva_) {
+	uint8_t *kva = kva_;
+	size_t page_idx, page_cnt;
+
+	if (kva == NULL)
+		return;
+	ASSERT (is_vmalloc_vaddr (kva));
+	ASSERT (pg_ofs (kva) == 0);
+
+	lock_acquire (&vmalloc_lock);
+	page_idx = (kva - (uint8_t *) VMALLOC_START) / PGSIZE;
+
+	/* Count pages up to the guard page. */
+	for (page_cnt = 0; ; page_cnt++) {
+		uint64_t *pte = pml4e_walk (base_pml4,
+				(uint64_t) kva + PGSIZE * page_cnt, false);
+		if (pte == NULL || !(*pte & PTE_P))
+			break;
+	}
+	ASSERT (page_cnt > 0);
+
+	unmap_pages (kva, page_cnt);
+	bitmap_set_multiple (used_map, page_idx, page_cnt + 1, false);
+	lock_release (&vmalloc_lock);
+}
+
+/* Obtains PAGE_CNT pages of kernel memory, as for
+   palloc_get_multiple(), except that when no physically
+   contiguous run is free the pages come from vmalloc() instead.
+   PAL_USER may not be set.  Free the pages with vfree_pages(). */
+void *
+vmalloc_pages (enum palloc_flags flags, size_t page_cnt) {
+	void *pages;
+
+	ASSERT (!(flags & PAL_USER));
+
+	pages = palloc_get_multiple (flags & ~PAL_ASSERT, page_cnt);
+	if (pages == NULL && page_cnt > 1) {
+		pages = vmalloc (PGSIZE * page_cnt);
+		if (pages != NULL && (flags & PAL_ZERO))
+			memset (pages, 0, PGSIZE * page_cnt);
+	}
+	if (pages == NULL && (flags & PAL_ASSERT))
+		PANIC ("vmalloc_pages: out of pages");
+	return pages;
+}
+
+/* Frees the PAGE_CNT pages at PAGES, which were obtained from
+   vmalloc_pages(). */
+void
+vfree_pages (void *pages, size_t page_cnt) {
+	if (is_vmalloc_vaddr (pages))
+		vfree (pages);
+	else
+		palloc_free_multiple (pages, page_cnt);
+}
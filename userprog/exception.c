@@ -2,6 +2,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/uaccess.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "intrinsic.h"
@@ -146,6 +147,11 @@ page_fault (struct intr_frame *f) {
 		return;
 #endif
 
+	/* A kernel access to user memory that cannot be satisfied is
+	   reported to the code that made it, if it expects faults. */
+	if (!user && uaccess_fixup (f))
+		return;
+
 	/* Count page faults. */
 	page_fault_cnt++;
 
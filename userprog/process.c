@@ -14,6 +14,7 @@
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
+#include "threads/vmalloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
@@ -172,6 +173,23 @@ duplicate_pte(uint64_t *pte, void *va, void *aux)
 		return false;
 	}
 
+	/* Large mappings are copied into a new large page as a whole. */
+
+	if (is_large_pte(pte))
+	{
+		newpage = palloc_get_large_page(PAL_USER);
+		if (newpage == NULL)
+			return false;
+
+		memcpy(newpage, parent_page, LARGE_PGSIZE);
+		if (!pml4_set_large_page(thread_current()->pml4, va, newpage, is_writable(pte)))
+		{
+			palloc_free_multiple(newpage, LARGE_PGSIZE / PGSIZE);
+			return false;
+		}
+		return true;
+	}
+
 	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
 	 *    TODO: NEWPAGE. */
 
@@ -186,7 +204,7 @@ duplicate_pte(uint64_t *pte, void *va, void *aux)
 	 *    TODO: check whether parent's page is writable or not (set WRITABLE
 	 *    TODO: according to the result). */
 
-	memcpy(newpage, parent_page, PGSIZE);
+	copy_page(newpage, parent_page);
 	writable = is_writable(pte);
 
 	/* 5. Add new page to child's page table at address VA with WRITABLE
@@ -436,7 +454,7 @@ void process_exit(void)
 	{
 		close(fd);
 	}
-	palloc_free_multiple((*(thread_current())).fdTable, 3);
+	vfree_pages((*(thread_current())).fdTable, 3);
 	file_close((*(thread_current())).threadFile);
 	process_cleanup();
 
@@ -480,8 +498,12 @@ process_cleanup(void)
 void process_activate(struct thread *next)
 {
 
-	/* Activate thread's page tables. */
-	pml4_activate(next->pml4);
+	/* Activate thread's page tables.  A kernel thread only touches
+	 * kernel mappings, which every pml4 shares, so it keeps running
+	 * on whatever address space is loaded instead of paying for a
+	 * CR3 reload (pml4_destroy() moves it off a dying pml4). */
+	if (next->pml4 != NULL)
+		pml4_activate(next->pml4);
 
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update(next);
@@ -755,6 +777,23 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	file_seek(file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0)
 	{
+		/* A writable run of zeros that covers an aligned 2 MB
+		 * region, such as a large aligned array in .bss, gets a
+		 * large page if one is free. */
+		if (writable && read_bytes == 0 && zero_bytes >= LARGE_PGSIZE && (uint64_t)upage % LARGE_PGSIZE == 0)
+		{
+			uint8_t *kpages = palloc_get_large_page(PAL_USER | PAL_ZERO);
+
+			if (kpages != NULL && pml4_set_large_page(thread_current()->pml4, upage, kpages, true))
+			{
+				zero_bytes -= LARGE_PGSIZE;
+				upage += LARGE_PGSIZE;
+				continue;
+			}
+			if (kpages != NULL)
+				palloc_free_multiple(kpages, LARGE_PGSIZE / PGSIZE);
+		}
+
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
 		 * and zero the final PAGE_ZERO_BYTES bytes. */
@@ -832,14 +871,6 @@ install_page(void *upage, void *kpage, bool writable)
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment(struct page *page, void *aux)
-{
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -862,6 +893,20 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT(pg_ofs(upage) == 0);
 	ASSERT(ofs % PGSIZE == 0);
 
+	/* Read-only pages read from FILE are shared with every process
+	 * running the same program. */
+	if (!writable && read_bytes > 0)
+	{
+		size_t text_bytes = ROUND_UP(read_bytes, PGSIZE);
+
+		if (!do_mmap_text(file, ofs, upage, read_bytes))
+			return false;
+		zero_bytes -= text_bytes - read_bytes;
+		read_bytes = 0;
+		upage += text_bytes;
+		ofs += text_bytes;
+	}
+
 	while (read_bytes > 0 || zero_bytes > 0)
 	{
 		/* Do calculate how to fill this page.
@@ -870,31 +915,46 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer(VM_ANON, upage,
-											writable, lazy_load_segment, aux))
-			return false;
+		/* Pages with nothing to read are plain zeroed anonymous
+		 * memory; the others are read from FILE on first fault. */
+		if (page_read_bytes == 0)
+		{
+			if (!vm_alloc_page(VM_ANON, upage, writable))
+				return false;
+		}
+		else
+		{
+			struct load_info *info = load_info_new(file, ofs, page_read_bytes);
+			if (info == NULL)
+				return false;
+			if (!vm_alloc_page_with_initializer(VM_ANON, upage,
+												writable, vm_load_file_page, info))
+			{
+				load_info_free(info);
+				return false;
+			}
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += PGSIZE;
 	}
 	return true;
 }
 
-/* Create a PAGE of stack at the USER_STACK. Return true on success. */
+/* Create the stack at the USER_STACK. Return true on success. */
 static bool
 setup_stack(struct intr_frame *if_)
 {
 	bool success = false;
-	void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	if (vm_setup_stack())
+	{
+		success = true;
+		if_->rsp = USER_STACK;
+	}
 
 	return success;
 }
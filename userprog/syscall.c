@@ -16,6 +16,7 @@
 #include "threads/vaddr.h"
 #include "userprog/process.h"
 #include "threads/synch.h"
+#include "userprog/uaccess.h"
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -33,6 +34,11 @@ void syscall_handler (struct intr_frame *);
 #define MSR_LSTAR 0xc0000082        /* Long mode SYSCALL target */
 #define MSR_SYSCALL_MASK 0xc0000084 /* Mask for the eflags */
 
+/* read() and write() pass data through a buffer of this many bytes
+ * on the kernel stack, and take a page for it only when a transfer
+ * is larger, so that small transfers leave the kernel pool alone. */
+#define SMALL_IO_SIZE 256
+
 void
 syscall_init (void) {
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
@@ -82,25 +88,27 @@ void exit(int status) {
 
 /* Edited Code - Jinhyen Kim (Project 2 - System Call) */
 
-/* Edited Code - Jinhyen Kim
-   There are three cases where we should terminate the User Process:
-      1: When the pointer is a NULL pointer
-      2: When the pointer is pointing to an unmapped virtual memory
-      3: When the pointer is pointer to Kernel virtual memory address space
-   For these three cases, we terminate the user process.*/
+/* User memory is never validated ahead of time.  Arguments are
+   copied in and results copied out with the primitives in
+   userprog/uaccess.c, and a process that passes an invalid
+   pointer is terminated when the copy fails. */
 
-void checkUMA (void* userAddress) {
+/* Size of the kernel buffer that file names are copied into.
+   No file name can be this long, so longer ones simply fail. */
+#define NAME_BUF_SIZE 128
 
-	if (userAddress == NULL) {
-		exit(-1);
-	}
-	if (!(is_user_vaddr(userAddress))) {
-		exit(-1);
-	}
-	if (pml4_get_page(((*(thread_current ())).pml4), userAddress) == NULL) {	
+/* Copies the user string USRC into DST, which holds SIZE bytes.
+   Terminates the process if USRC is invalid.  Returns false if
+   the string does not fit. */
+
+static bool getUserString (char *dst, const char *usrc, size_t size) {
+
+	int64_t length = strncpy_from_user(dst, usrc, size);
+
+	if (length < 0)
 		exit(-1);
-	}
-	return;
+
+	return (size_t) length < size;
 
 }
 
@@ -113,32 +121,42 @@ pid_t fork (const char *thread_name, struct intr_frame *f) {
 	/* Edited Code - Jinhyen Kim
 	   fork() is performed at process.c. */
 
-	return process_fork(thread_name, f);
+	char name[16];
 
-}
+	/* The new thread's name is truncated anyway, so a name
+	      that does not fit is cut short rather than rejected. */
+	if (!getUserString(name, thread_name, sizeof name))
+		name[sizeof name - 1] = '\0';
 
-int exec (char *file_name) {
+	return process_fork(name, f);
 
-	/* When we have a file as parameter, we need to check if 
-	      the file location is a valid User Memory. */
-	checkUMA(file_name);
+}
 
-	int size = strlen(file_name);
+int exec (char *file_name) {
 
 	/* We need to convert the current process to an executable
 	      file. This is done by:
 	         1. Calling palloc_get_page() to get a free page to store
 	               the executable. If this returns NULL, it means no
 	               pages are avaliable.
-	         2. Calling strlcpy() to copy the file into the page.
+	         2. Calling strncpy_from_user() to copy the command line
+	               into the page. An invalid command line terminates
+	               the process, and one longer than a page fails.
 	         3. Calling process_exec() to see if the file is executable. */
 	
-	char *fn_copy = palloc_get_page(PAL_ZERO);
+	char *fn_copy = palloc_get_page(0);
 	
 	if (fn_copy == NULL)
 		exit(-1);
 
-	strlcpy(fn_copy, file_name, size + 1);
+	int64_t length = strncpy_from_user(fn_copy, file_name, PGSIZE);
+
+	if (length < 0 || length == PGSIZE) {
+		palloc_free_page(fn_copy);
+		if (length < 0)
+			exit(-1);
+		return -1;
+	}
 
 	if (process_exec(fn_copy) == -1)
 		return -1;
@@ -156,14 +174,17 @@ int wait (pid_t pid) {
 
 bool create (const char *file, unsigned initial_size) {
 
-	/* When we create a new file, we need to check if the file
-	      location is a valid User Memory. */
-	checkUMA(file);
+	/* When we create a new file, we first copy its name into
+	      kernel memory. */
+	char name[NAME_BUF_SIZE];
+
+	if (!getUserString(name, file, sizeof name))
+		return false;
 
 	/* We create a new file with filesys_create().
 	   If it was successful, we return true.
 	   Otherwise, we return false. */
-	if (filesys_create(file, initial_size)) {
+	if (filesys_create(name, initial_size)) {
 		return true;
 	}
 	else {
@@ -174,14 +195,17 @@ bool create (const char *file, unsigned initial_size) {
 
 bool remove (const char *file) {
 
-	/* When we delete a file, we need to check if the file
-	      location is a valid User Memory. */
-	checkUMA(file);
+	/* When we delete a file, we first copy its name into
+	      kernel memory. */
+	char name[NAME_BUF_SIZE];
+
+	if (!getUserString(name, file, sizeof name))
+		return false;
 
 	/* We delete the file with filesys_remove().
 	   If it was successful, we return true.
 	   Otherwise, we return false. */
-	if (filesys_remove(file)) {
+	if (filesys_remove(name)) {
 		return true;
 	}
 	else {
@@ -193,17 +217,22 @@ bool remove (const char *file) {
 
 int open(const char *file) {
 
-	/* When we open a file, we need to check if the file
-	   location is a valid User Memory. */
-	checkUMA(file);
+	/* When we open a file, we first copy its name into
+	      kernel memory. */
+	char name[NAME_BUF_SIZE];
+
+	if (!getUserString(name, file, sizeof name))
+		return -1;
 
 	/* While we work at a file, we need to lock it first. */
 	lock_acquire(&fileLock);
 
-	struct file *targetFile = filesys_open(file);
+	struct file *targetFile = filesys_open(name);
 
-	if (targetFile == NULL)
+	if (targetFile == NULL) {
+		lock_release(&fileLock);
 		return -1;
+	}
 
 	/* When we open the file, we need to store a file descriptor
 	      and check whether the maximum file descriptor value is reached.
@@ -257,10 +286,6 @@ int filesize(int fd) {
 
 int read(int fd, void *buffer, unsigned size) {
 
-	/* When we read to an open file, we need to check if 
-	      the file location is a valid User Memory. */	
-	checkUMA(buffer);
-
 	/* This is invalid when either the fd index value is beyond the
 	      maximum value, or when there is no file at the given 
 	      fd index. */
@@ -279,7 +304,11 @@ int read(int fd, void *buffer, unsigned size) {
 
 	if (targetFile == 0)
 	{
-		*(char *)buffer = input_getc();
+		for (unsigned i = 0; i < size; i++) {
+			uint8_t key = input_getc();
+			if (!copy_to_user((uint8_t *) buffer + i, &key, 1))
+				exit(-1);
+		}
 		return size;
 	}
 
@@ -292,28 +321,56 @@ int read(int fd, void *buffer, unsigned size) {
 		return -1;
 	}
 
-	/* Otherwise, we call file_read. */
+	/* Otherwise, we call file_read.
+	   The file is read into a kernel buffer, on the stack for a
+	      small read and a page otherwise, and then copied out, so
+	      that the lock is never held while touching user memory. */
 
 	else
 	{
-		/* While we work at a file, we need to lock it first. */
-		lock_acquire(&fileLock);
+		char small[SMALL_IO_SIZE];
+		char *bounce = small;
+		unsigned bounceSize = sizeof small;
 
-		int bytesRead = file_read(targetFile, buffer, size);
+		if (size > sizeof small) {
+			bounce = palloc_get_page(0);
+			bounceSize = PGSIZE;
+			if (bounce == NULL)
+				return -1;
+		}
 
-		/* Once we are done with the file, we unlock it. */
-		lock_release(&fileLock);
+		unsigned bytesRead = 0;
+
+		while (bytesRead < size) {
+			unsigned chunk = size - bytesRead < bounceSize ? size - bytesRead : bounceSize;
+
+			/* While we work at a file, we need to lock it first. */
+			lock_acquire(&fileLock);
 
+			int n = file_read(targetFile, bounce, chunk);
+
+			/* Once we are done with the file, we unlock it. */
+			lock_release(&fileLock);
+
+			if (!copy_to_user((char *) buffer + bytesRead, bounce, n)) {
+				if (bounce != small)
+					palloc_free_page(bounce);
+				exit(-1);
+			}
+
+			bytesRead += n;
+			if ((unsigned) n < chunk)
+				break;
+		}
+
+		if (bounce != small)
+			palloc_free_page(bounce);
 		return bytesRead;
 	}
 }
 
 int write(int fd, const void *buffer, unsigned size) {
 
-	/* When we write to an open file, we need to check if 
-	      the file location is a valid User Memory. */
-	checkUMA(buffer);
-
 	/* This is invalid when either the fd index value is beyond the
 	      maximum value, or when there is no file at the given 
 	      fd index. */
@@ -326,39 +383,70 @@ int write(int fd, const void *buffer, unsigned size) {
 	if (targetFile == NULL)
 		return -1;
 
-	/* By our design, targetFile == 1 represents writing to the
-	      console.
-	   As such, we call putbuf. */
-	
-	if (targetFile == 1)
-	{
-		putbuf(buffer, size);
-		return size;
-	}
-
 	/* By our design, targetFile == 0 represents reading from 
 	      keyboard.
 	   This is invalid for write(), so we return -1. */
 
-	else if (targetFile == 0)
-	{
+	if (targetFile == 0)
 		return -1;
+
+	/* The data is copied in through a kernel buffer, so that the
+	      lock is never held while touching user memory.  The
+	      buffer is on the stack for a small write and a page
+	      otherwise, so that a console write of up to a page still
+	      reaches putbuf() in one piece and no other output lands
+	      in the middle of it. */
+
+	char small[SMALL_IO_SIZE];
+	char *bounce = small;
+	unsigned bounceSize = sizeof small;
+
+	if (size > sizeof small) {
+		bounce = palloc_get_page(0);
+		bounceSize = PGSIZE;
+		if (bounce == NULL)
+			return -1;
 	}
 
-	/* Otherwise, we call file_write. */
+	unsigned bytesWritten = 0;
+
+	while (bytesWritten < size) {
+		unsigned chunk = size - bytesWritten < bounceSize ? size - bytesWritten : bounceSize;
+
+		if (!copy_from_user(bounce, (const char *) buffer + bytesWritten, chunk)) {
+			if (bounce != small)
+				palloc_free_page(bounce);
+			exit(-1);
+		}
+
+		/* By our design, targetFile == 1 represents writing to the
+		      console.
+		   As such, we call putbuf. */
+
+		if (targetFile == 1) {
+			putbuf(bounce, chunk);
+			bytesWritten += chunk;
+			continue;
+		}
+
+		/* Otherwise, we call file_write. */
 
-	else
-	{
 		/* While we work at a file, we need to lock it first. */
 		lock_acquire(&fileLock);
 
-		int bytesWritten = file_write(targetFile, buffer, size);
+		int n = file_write(targetFile, bounce, chunk);
 
 		/* Once we are done with the file, we unlock it. */
 		lock_release(&fileLock);
 
-		return bytesWritten;
+		bytesWritten += n;
+		if ((unsigned) n < chunk)
+			break;
 	}
+
+	if (bounce != small)
+		palloc_free_page(bounce);
+	return bytesWritten;
 }
 
 void seek(int fd, unsigned position) {
@@ -439,6 +527,32 @@ void close(int fd) {
 
 }
 
+#ifdef VM
+static void *mmap(void *addr, size_t length, int writable, int fd, off_t offset) {
+
+	/* This is invalid when either the fd index value is beyond the
+	      maximum value, or when the fd is the console or has no
+	      file. */
+
+	if (fd < 2 || fd >= 1536)
+		return NULL;
+
+	struct file *targetFile = (*(thread_current())).fdTable[fd];
+
+	if (targetFile == NULL)
+		return NULL;
+
+	return do_mmap(addr, length, writable, targetFile, offset);
+
+}
+
+static void munmap(void *addr) {
+
+	do_munmap(addr);
+
+}
+#endif
+
 /* Edited Code - Jinhyen Kim (Project 2 - System Call) */
 
 void
@@ -465,6 +579,11 @@ syscall_handler (struct intr_frame *f UNUSED) {
 	SYS_TELL,                   Report current position in a file.
 	SYS_CLOSE,                  Close a file. */
 
+#ifdef VM
+	/* Page faults taken inside the kernel need it to grow the stack. */
+	thread_current ()->user_rsp = (void *) f->rsp;
+#endif
+
 	switch (((*(f)).R).rax) {
 
 		case SYS_HALT:
@@ -539,6 +658,33 @@ syscall_handler (struct intr_frame *f UNUSED) {
 			close((((*(f)).R).rdi));
 			break;			
 
+#ifdef VM
+		case SYS_MMAP:
+
+			(((*(f)).R).rax) = (uint64_t) mmap((void *) (((*(f)).R).rdi), (((*(f)).R).rsi), (((*(f)).R).rdx), (((*(f)).R).r10), (((*(f)).R).r8));
+			break;
+
+		case SYS_MUNMAP:
+
+			munmap((void *) (((*(f)).R).rdi));
+			break;
+
+		case SYS_MADVISE:
+
+			(((*(f)).R).rax) = vm_madvise((void *) (((*(f)).R).rdi), (((*(f)).R).rsi), (((*(f)).R).rdx));
+			break;
+
+		case SYS_MLOCK:
+
+			(((*(f)).R).rax) = vm_mlock((void *) (((*(f)).R).rdi), (((*(f)).R).rsi), true);
+			break;
+
+		case SYS_MUNLOCK:
+
+			(((*(f)).R).rax) = vm_mlock((void *) (((*(f)).R).rdi), (((*(f)).R).rsi), false);
+			break;
+#endif
+
 		default:
 
 			/* The default is only called if we call an invalid
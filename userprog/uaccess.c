@@ -0,0 +1,132 @@
+#include "userprog/uaccess.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+
+/* User memory access.
+ *
+ * Rather than walking the page table to validate every user
+ * pointer before touching it, the routines below simply access
+ * user memory.  Each instruction that may fault on a user address
+ * has an entry in the exception table, the __ex_table section,
+ * that names the instruction and a fixup address.  When a fault
+ * in kernel mode cannot be resolved otherwise, page_fault() calls
+ * uaccess_fixup(), which resumes execution at the fixup instead,
+ * and the routine reports the failure to its caller.
+ *
+ * The only check made up front is that the whole range lies
+ * below KERN_BASE, since kernel addresses would not fault. */
+
+/* One exception table entry. */
+struct ex_entry {
+	uintptr_t insn;             /* Address of the faulting instruction. */
+	uintptr_t fixup;            /* Where to resume after a fault. */
+};
+
+/* Bounds of the exception table, provided by the linker script. */
+extern const struct ex_entry __start_ex_table[], __stop_ex_table[];
+
+/* Emits an exception table entry from INSN to FIXUP. */
+#define EX_ENTRY(INSN, FIXUP)                   \
+	".pushsection __ex_table, \"a\"\n"          \
+	".balign 8\n"                               \
+	".quad " INSN ", " FIXUP "\n"               \
+	".popsection\n"
+
+/* Returns true if [UADDR, UADDR + SIZE) is entirely user space. */
+static bool
+is_user_range (const void *uaddr, size_t size) {
+	uintptr_t start = (uintptr_t) uaddr;
+	return start + size >= start && start + size <= KERN_BASE;
+}
+
+/* Copies SIZE bytes from SRC to DST, where either may be a user
+   address.  Returns the number of bytes left uncopied, which is
+   nonzero only if a fault stopped the copy.  REP MOVSB leaves
+   RCX at the remaining count when it faults, so the fixup has
+   nothing to do. */
+static size_t
+raw_copy (void *dst, const void *src, size_t size) {
+	__asm __volatile (
+			"1: rep movsb\n"
+			"2:\n"
+			EX_ENTRY ("1b", "2b")
+			: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+	return size;
+}
+
+/* Reads the byte at user address UADDR into *BYTE.  Returns
+   false if the read faulted. */
+static bool
+get_user_byte (const uint8_t *uaddr, uint8_t *byte) {
+	int error;
+	uint8_t value;
+
+	__asm __volatile (
+			"xorl %0, %0\n"
+			"1: movb (%2), %1\n"
+			"jmp 3f\n"
+			"2: movl $1, %0\n"
+			"3:\n"
+			EX_ENTRY ("1b", "2b")
+			: "=&r" (error), "=&q" (value) : "r" (uaddr) : "memory");
+	*byte = value;
+	return !error;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns true
+   if successful, false if any part of the source is invalid. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	if (!is_user_range (usrc, size))
+		return false;
+	return raw_copy (dst, usrc, size) == 0;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns true
+   if successful, false if any part of the destination is
+   invalid. */
+bool
+copy_to_user (void *udst, const void *src, size_t size) {
+	if (!is_user_range (udst, size))
+		return false;
+	return raw_copy (udst, src, size) == 0;
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which has room for SIZE bytes.  Returns the length of the
+   string, not counting the null terminator, if it fits.  If no
+   null terminator is found within SIZE bytes, DST is left
+   unterminated and SIZE is returned.  Returns -1 if the string
+   runs into an invalid address. */
+int64_t
+strncpy_from_user (char *dst, const char *usrc, size_t size) {
+	const uint8_t *src = (const uint8_t *) usrc;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		uint8_t c;
+
+		if (!is_user_vaddr (src + i) || !get_user_byte (src + i, &c))
+			return -1;
+		dst[i] = c;
+		if (c == '\0')
+			return i;
+	}
+	return size;
+}
+
+/* If F faulted on an instruction listed in the exception table,
+   redirects it to the fixup and returns true.  Otherwise returns
+   false. */
+bool
+uaccess_fixup (struct intr_frame *f) {
+	const struct ex_entry *e;
+
+	for (e = __start_ex_table; e < __stop_ex_table; e++)
+		if (e->insn == f->rip) {
+			f->rip = e->fixup;
+			return true;
+		}
+	return false;
+}
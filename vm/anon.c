@@ -1,7 +1,38 @@
-/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
+/* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page).
+ *
+ * Evicted anonymous pages go to the swap disk, hd1:1, which is
+ * divided into slots of one page each.  A bitmap records which
+ * slots are in use.  The frame table evicts pages in batches, and
+ * the pages of a batch are written to a run of consecutive slots,
+ * so that the disk sees one sequential burst.  Such a run is a
+ * swap cluster.  Swapping in any page of a cluster reads back the
+ * others of the same address space along with it, again in slot
+ * order, on the theory that pages evicted together are likely to
+ * be needed together.
+ *
+ * In front of the disk sits zswap, a pool of compressed pages in
+ * kernel memory.  An evicted page is compressed and kept there if
+ * it shrinks to half its size or less, so that swapping it back in
+ * costs a decompression instead of disk I/O.  Other pages go
+ * straight to disk.  When the pool is full, its oldest entries are
+ * written back to disk, a cluster at a time, to make room.
+ *
+ * A frame shared copy-on-write is swapped out once for all of its
+ * pages.  They are chained through anon.next, starting from the
+ * page that the slot or zswap entry records, and all point to the
+ * same copy.  Swapping in any one of them puts all of them back on
+ * the frame, still shared. */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +48,83 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)   /* Sectors per slot. */
+
+/* A run of consecutive slots written in one burst.  PAGES[I] is
+ * the first page in slot START + I, or NULL once the slot's pages
+ * have been swapped back in or destroyed. */
+struct swap_cluster {
+	size_t start;                       /* First slot. */
+	size_t slot_cnt;                    /* Number of slots. */
+	size_t used;                        /* Slots handed out so far. */
+	size_t live;                        /* Pages still in the cluster. */
+	struct page *pages[SWAP_CLUSTER];
+};
+
+/* A compressed page in zswap.  Entries are allocated with malloc(),
+ * so the pool lives in kernel pool arenas. */
+struct zswap_entry {
+	struct page *page;                  /* First page sharing it. */
+	size_t size;                        /* Bytes in DATA. */
+	struct list_elem elem;              /* In zswap_lru. */
+	uint8_t data[];                     /* Compressed contents. */
+};
+
+/* Largest compressed size worth keeping, header included. */
+#define ZSWAP_MAX_ENTRY (PGSIZE / 2)
+
+/* Most compressed bytes zswap holds. */
+#define ZSWAP_MAX_BYTES (1 << 20)
+
+static struct list zswap_lru;           /* Entries, oldest first. */
+static size_t zswap_pages;              /* Entries in zswap. */
+static size_t zswap_bytes;              /* Compressed bytes in zswap. */
+static void *zswap_work;                /* Scratch for lz_compress(). */
+static uint8_t *zswap_buf;              /* Compression output. */
+static void *zswap_bounce;              /* Decompressed page for writeback. */
+
+static struct bitmap *swap_map;         /* Slots in use. */
+static size_t swap_cursor;              /* Where to look for slots next. */
+static struct lock swap_lock;           /* Protects everything here. */
+
+/* The cluster that pages being swapped out now go to, and how many
+ * more pages the current batch will write.  BATCH_LOCK is held from
+ * swap_cluster_begin() to swap_cluster_end(), since kswapd writes
+ * out a batch without the frame lock and another eviction may start
+ * one meanwhile. */
+static struct swap_cluster *open_cluster;
+static size_t batch_left;
+static struct lock batch_lock;
+
+/* Statistics. */
+static long long pages_out;             /* Pages written to swap. */
+static long long bursts;                /* Clusters written. */
+static long long pages_in;              /* Pages read back on demand. */
+static long long pages_ahead;           /* Pages read back ahead. */
+static long long zswap_stores;          /* Pages put in zswap. */
+static long long zswap_stored_bytes;    /* ...and their compressed size. */
+static long long zswap_rejects;         /* Pages that did not compress. */
+static long long zswap_writebacks;      /* Entries moved to disk. */
+static long long zswap_hits;            /* Swap-ins served by zswap. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_map = bitmap_create (swap_disk != NULL
+			? disk_size (swap_disk) / SLOT_SECTORS : 0);
+	if (swap_map == NULL)
+		PANIC ("swap bitmap creation failed");
+	lock_init (&swap_lock);
+	lock_init (&batch_lock);
+
+	list_init (&zswap_lru);
+	zswap_work = malloc (LZ_WORK_SIZE);
+	zswap_buf = malloc (ZSWAP_MAX_ENTRY);
+	zswap_bounce = palloc_get_page (0);
+	if (zswap_work == NULL || zswap_buf == NULL || zswap_bounce == NULL)
+		PANIC ("zswap initialization failed");
 }
 
 /* Initialize the file mapping */
@@ -31,22 +134,419 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->cluster = NULL;
+	anon_page->zentry = NULL;
+	anon_page->next = NULL;
+	clear_page (kva);
+	return true;
+}
+
+/* Chains the pages sharing FRAME, whose contents are going out to
+ * swap, from the first one.  The frame lock must be held. */
+static void
+chain_build (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		struct list_elem *next = list_next (e);
+
+		page->anon.next = next != list_end (&frame->pages)
+			? list_entry (next, struct page, frame_elem) : NULL;
+	}
+}
+
+/* Puts the pages chained from HEAD, which share a copy that has
+ * just been read into FRAME, back on FRAME, and undoes the chain.
+ * The page being swapped in is on FRAME already.  The frame lock
+ * must be held. */
+static void
+chain_attach (struct page *head, struct frame *frame) {
+	while (head != NULL) {
+		struct page *next = head->anon.next;
+
+		head->anon.next = NULL;
+		if (head->frame == NULL)
+			frame_link (frame, head);
+		head = next;
+	}
+}
+
+/* Returns true if PAGE is chained from HEAD. */
+static bool
+chain_contains (struct page *head, struct page *page) {
+	for (; head != NULL; head = head->anon.next)
+		if (head == page)
+			return true;
+	return false;
+}
+
+/* Removes PAGE from the chain that starts at *HEAD.  Returns true
+ * if it was the only page in it, which is left as it was. */
+static bool
+chain_remove (struct page **head, struct page *page) {
+	struct page **p;
+
+	if (*head == page && page->anon.next == NULL)
+		return true;
+	for (p = head; *p != page; p = &(*p)->anon.next)
+		ASSERT (*p != NULL);
+	*p = page->anon.next;
+	page->anon.next = NULL;
+	return false;
+}
+
+/* Allocates a run of up to CNT free slots, preferring the slots
+ * just past the last allocation, and returns a cluster for it, or
+ * NULL if swap is full or memory runs out.  The swap lock must be
+ * held. */
+static struct swap_cluster *
+cluster_create (size_t cnt) {
+	struct swap_cluster *cluster;
+	size_t start = BITMAP_ERROR;
+
+	ASSERT (cnt >= 1 && cnt <= SWAP_CLUSTER);
+
+	for (; cnt > 0; cnt /= 2) {
+		start = bitmap_scan_and_flip (swap_map, swap_cursor, cnt, false);
+		if (start == BITMAP_ERROR)
+			start = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+		if (start != BITMAP_ERROR)
+			break;
+	}
+	if (start == BITMAP_ERROR)
+		return NULL;
+
+	cluster = calloc (1, sizeof *cluster);
+	if (cluster == NULL) {
+		bitmap_set_multiple (swap_map, start, cnt, false);
+		return NULL;
+	}
+	cluster->start = start;
+	cluster->slot_cnt = cnt;
+	swap_cursor = start + cnt;
+	bursts++;
+	return cluster;
+}
+
+/* Returns the slots of CLUSTER that were never handed out, and
+ * frees CLUSTER if no page is left in it.  The swap lock must be
+ * held. */
+static void
+cluster_close (struct swap_cluster *cluster) {
+	size_t unused = cluster->slot_cnt - cluster->used;
+
+	bitmap_set_multiple (swap_map, cluster->start + cluster->used, unused,
+			false);
+	cluster->slot_cnt = cluster->used;
+	if (cluster->live == 0)
+		free (cluster);
+}
+
+/* Announces that up to CNT pages are about to be swapped out, so
+ * that anonymous ones among them land in consecutive slots.  Waits
+ * for any other batch to end first. */
+void
+swap_cluster_begin (size_t cnt) {
+	lock_acquire (&batch_lock);
+	lock_acquire (&swap_lock);
+	ASSERT (open_cluster == NULL);
+	batch_left = cnt < SWAP_CLUSTER ? cnt : SWAP_CLUSTER;
+	lock_release (&swap_lock);
+}
+
+/* Ends the batch started by swap_cluster_begin(). */
+void
+swap_cluster_end (void) {
+	lock_acquire (&swap_lock);
+	if (open_cluster != NULL)
+		cluster_close (open_cluster);
+	open_cluster = NULL;
+	batch_left = 0;
+	lock_release (&swap_lock);
+	lock_release (&batch_lock);
+}
+
+/* Removes the pages in slot START + IDX from CLUSTER and frees the
+ * slot.  Does not free CLUSTER.  The swap lock must be held. */
+static void
+cluster_remove (struct swap_cluster *cluster, size_t idx) {
+	struct page *page;
+
+	ASSERT (cluster->pages[idx] != NULL);
+
+	for (page = cluster->pages[idx]; page != NULL; page = page->anon.next)
+		page->anon.cluster = NULL;
+	cluster->pages[idx] = NULL;
+	cluster->live--;
+	bitmap_reset (swap_map, cluster->start + idx);
+}
+
+/* Reads slot SLOT into KVA. */
+static void
+read_slot (size_t slot, void *kva) {
+	for (size_t i = 0; i < SLOT_SECTORS; i++)
+		disk_read (swap_disk, slot * SLOT_SECTORS + i,
+				kva + i * DISK_SECTOR_SIZE);
+}
+
+/* Writes KVA to slot SLOT. */
+static void
+write_slot (size_t slot, const void *kva) {
+	for (size_t i = 0; i < SLOT_SECTORS; i++)
+		disk_write (swap_disk, slot * SLOT_SECTORS + i,
+				kva + i * DISK_SECTOR_SIZE);
+}
+
+/* Writes KVA, the contents of PAGE and the pages chained from it,
+ * to the next slot of CLUSTER, which must have one left.  The swap
+ * lock must be held. */
+static void
+cluster_append (struct swap_cluster *cluster, struct page *page,
+		const void *kva) {
+	size_t idx = cluster->used++;
+
+	ASSERT (idx < cluster->slot_cnt);
+
+	cluster->pages[idx] = page;
+	cluster->live++;
+	write_slot (cluster->start + idx, kva);
+	for (; page != NULL; page = page->anon.next)
+		page->anon.cluster = cluster;
+	pages_out++;
+}
+
+/* Writes KVA, the contents of PAGE and the pages chained from it,
+ * to swap as part of the current batch.  Returns false if swap is
+ * full.  The swap lock must be held. */
+static bool
+swap_write (struct page *page, const void *kva) {
+	if (open_cluster != NULL && open_cluster->used == open_cluster->slot_cnt) {
+		cluster_close (open_cluster);
+		open_cluster = NULL;
+	}
+	if (open_cluster == NULL)
+		open_cluster = cluster_create (batch_left > 0 ? batch_left : 1);
+	if (open_cluster == NULL)
+		return false;
+
+	cluster_append (open_cluster, page, kva);
+	if (batch_left > 0)
+		batch_left--;
+
+	/* Outside a batch the cluster holds just this page. */
+	if (batch_left == 0) {
+		cluster_close (open_cluster);
+		open_cluster = NULL;
+	}
+	return true;
+}
+
+/* Removes ENTRY from zswap and frees it.  The swap lock must be
+ * held. */
+static void
+zswap_remove (struct zswap_entry *entry) {
+	struct page *page;
+
+	list_remove (&entry->elem);
+	zswap_pages--;
+	zswap_bytes -= entry->size;
+	for (page = entry->page; page != NULL; page = page->anon.next)
+		page->anon.zentry = NULL;
+	free (entry);
+}
+
+/* Writes the oldest entries of zswap back to disk until SIZE more
+ * bytes fit in it.  Returns false if swap fills up first.  The swap
+ * lock must be held. */
+static bool
+zswap_make_room (size_t size) {
+	while (zswap_bytes + size > ZSWAP_MAX_BYTES) {
+		struct swap_cluster *cluster;
+
+		ASSERT (!list_empty (&zswap_lru));
+		cluster = cluster_create (SWAP_CLUSTER);
+		if (cluster == NULL)
+			return false;
+
+		/* A cluster's worth at a time, for a sequential burst. */
+		while (cluster->used < cluster->slot_cnt
+				&& !list_empty (&zswap_lru)) {
+			struct zswap_entry *entry = list_entry (list_front (&zswap_lru),
+					struct zswap_entry, elem);
+			struct page *page = entry->page;
+
+			lz_decompress (entry->data, entry->size, zswap_bounce, PGSIZE);
+			cluster_append (cluster, page, zswap_bounce);
+			zswap_remove (entry);
+			zswap_writebacks++;
+		}
+		cluster_close (cluster);
+	}
+	return true;
+}
+
+/* Tries to keep KVA, the contents of PAGE and the pages chained
+ * from it, in zswap.  Returns false if it does not compress well
+ * or there is no room.  The swap lock must be held. */
+static bool
+zswap_store (struct page *page, const void *kva) {
+	size_t max = ZSWAP_MAX_ENTRY - sizeof (struct zswap_entry);
+	struct zswap_entry *entry;
+	size_t size;
+
+	size = lz_compress (kva, PGSIZE, zswap_buf, max, zswap_work);
+	if (size == 0) {
+		zswap_rejects++;
+		return false;
+	}
+	if (!zswap_make_room (size))
+		return false;
+	entry = malloc (sizeof *entry + size);
+	if (entry == NULL)
+		return false;
+
+	entry->page = page;
+	entry->size = size;
+	memcpy (entry->data, zswap_buf, size);
+	list_push_back (&zswap_lru, &entry->elem);
+	zswap_pages++;
+	zswap_bytes += size;
+	for (; page != NULL; page = page->anon.next)
+		page->anon.zentry = entry;
+	zswap_stores++;
+	zswap_stored_bytes += size;
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct swap_cluster *cluster;
+	bool ahead = page->advice != MADV_RANDOM;
+	size_t i;
+
+	/* kswapd may move zswap entries to disk without the frame lock,
+	 * so where the page is can only be trusted under the swap
+	 * lock. */
+	lock_acquire (&swap_lock);
+	if (anon_page->zentry != NULL) {
+		struct zswap_entry *entry = anon_page->zentry;
+		struct page *head = entry->page;
+		bool success;
+
+		success = lz_decompress (entry->data, entry->size, kva, PGSIZE)
+			== PGSIZE;
+		zswap_remove (entry);
+		zswap_hits++;
+		lock_release (&swap_lock);
+		if (success)
+			chain_attach (head, page->frame);
+		return success;
+	}
+	cluster = anon_page->cluster;
+	if (cluster == NULL) {
+		lock_release (&swap_lock);
+		return false;
+	}
+
+	/* The frame lock, held by our caller, keeps the pages of the
+	 * cluster from being destroyed or faulted in meanwhile. */
+	for (i = 0; i < cluster->slot_cnt; i++) {
+		struct page *other = cluster->pages[i];
+		void *other_kva;
+
+		if (chain_contains (other, page)) {
+			read_slot (cluster->start + i, kva);
+			cluster_remove (cluster, i);
+			chain_attach (other, page->frame);
+			pages_in++;
+		} else if (other != NULL && ahead && other->pml4 == page->pml4) {
+			/* Only free memory is used for reading ahead. */
+			other_kva = vm_prefetch_begin (other);
+			if (other_kva == NULL) {
+				ahead = false;
+				continue;
+			}
+			read_slot (cluster->start + i, other_kva);
+			cluster_remove (cluster, i);
+			chain_attach (other, other->frame);
+			vm_prefetch_end (other);
+			pages_ahead++;
+		}
+	}
+	if (cluster->live == 0 && cluster != open_cluster)
+		free (cluster);
+	lock_release (&swap_lock);
+	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Swap out the page by writing contents to the swap disk.  PAGE is
+ * the first of the pages sharing its frame, and they all share the
+ * copy. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	void *kva = page->frame->kva;
+	bool success;
+
+	ASSERT (page == page->frame->page);
+
+	chain_build (page->frame);
+	lock_acquire (&swap_lock);
+	success = zswap_store (page, kva) || swap_write (page, kva);
+	lock_release (&swap_lock);
+	if (!success)
+		chain_attach (page, page->frame);
+	return success;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	struct swap_cluster *cluster;
+	size_t i;
+
+	lock_acquire (&swap_lock);
+	if (anon_page->zentry != NULL) {
+		struct zswap_entry *entry = anon_page->zentry;
+
+		if (chain_remove (&entry->page, page))
+			zswap_remove (entry);
+		lock_release (&swap_lock);
+		return;
+	}
+	cluster = anon_page->cluster;
+	if (cluster == NULL) {
+		lock_release (&swap_lock);
+		return;
+	}
+
+	/* Only the last page sharing a slot frees it. */
+	for (i = 0; i < cluster->used; i++)
+		if (chain_contains (cluster->pages[i], page)) {
+			if (chain_remove (&cluster->pages[i], page))
+				cluster_remove (cluster, i);
+			break;
+		}
+	if (cluster->live == 0 && cluster != open_cluster)
+		free (cluster);
+	lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+vm_anon_print_stats (void) {
+	printf ("Swap: %zu of %zu slots in use, %lld pages out in %lld bursts, "
+			"%lld in, %lld read ahead\n",
+			bitmap_count (swap_map, 0, bitmap_size (swap_map), true),
+			bitmap_size (swap_map), pages_out, bursts, pages_in, pages_ahead);
+	printf ("Zswap: %zu pages in %zu bytes, %lld stored at %lld%% of their size, "
+			"%lld rejected, %lld written back, %lld of %lld swap-ins hit\n",
+			zswap_pages, zswap_bytes, zswap_stores,
+			zswap_stores != 0 ? zswap_stored_bytes * 100 / (zswap_stores * PGSIZE)
+			: 0, zswap_rejects, zswap_writebacks, zswap_hits,
+			zswap_hits + pages_in);
 }
@@ -1,6 +1,33 @@
-/* file.c: Implementation of memory backed file object (mmaped object). */
+/* file.c: Implementation of memory backed file object (mmaped object).
+ *
+ * Frames that hold file contents are kept in a page index, keyed
+ * by inode and offset.  A page of a mapping that faults first looks
+ * there, so every page that maps the same part of the same file,
+ * in whatever process, shares one frame: the file is read into
+ * memory once, and what one process writes, the others see.  A
+ * frame leaves the index when it is evicted or the last page
+ * mapping it goes away, and only then is it written back, once,
+ * if any of its pages wrote to it.
+ *
+ * The read-only text of programs is mapped the same way, so every
+ * process running a program shares one copy of its code.  Text and
+ * mappings of the same file are kept apart in the index, and so are
+ * text pages that read different amounts of the same file page,
+ * since the last page of a segment is zero-filled past its end and
+ * the next segment may begin in that same page.
+ *
+ * The frame lock, held by the callers of the page operations,
+ * protects the index and the frames in it. */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,9 +41,41 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* The page index: frames holding file contents. */
+static struct hash page_index;
+
+/* Statistics. */
+static long long pages_read;            /* Pages read from files. */
+static long long pages_shared;          /* Faults served by the index. */
+static long long pages_written;         /* Pages written back. */
+static long long batch_pages;           /* ...by file_write_back(). */
+static long long batch_runs;            /* ...in this many runs. */
+
+static uint64_t
+index_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *frame = hash_entry (e, struct frame, index_elem);
+
+	return hash_bytes (&frame->inode, sizeof frame->inode)
+		^ hash_int (frame->ofs / PGSIZE);
+}
+
+static bool
+index_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, index_elem);
+	const struct frame *b = hash_entry (b_, struct frame, index_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->text_bytes < b->text_bytes;
+}
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	hash_init (&page_index, index_hash, index_less, NULL);
 }
 
 /* Initialize the file backed page */
@@ -25,34 +84,307 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
+	struct file_page *file_page UNUSED = &page->file;
+	return true;
+}
+
+/* Adds a page at VA to the current process, not resident yet, that
+ * maps READ_BYTES bytes of REGION's file at OFS, followed by zeros.
+ * Returns the page, or NULL if VA is taken or memory runs out. */
+static struct page *
+file_page_new (void *va, bool writable, struct mmap_region *region,
+		off_t ofs, size_t read_bytes) {
+	struct page *page;
+
+	if (!vm_alloc_page_with_initializer (VM_FILE, va, writable, NULL, NULL))
+		return NULL;
+	page = spt_find_page (&thread_current ()->spt, va);
+	file_backed_initializer (page, VM_FILE, NULL);
+	page->file.region = region;
+	page->file.ofs = ofs;
+	page->file.read_bytes = read_bytes;
+	region->page_cnt++;
+	return page;
+}
+
+/* Adds to the current process a page that maps what SRC, a page of
+ * another process, maps, for fork.  Returns the page, not resident
+ * yet, or NULL if memory runs out.  The frame lock must be held. */
+struct page *
+file_page_dup (struct page *src) {
+	struct page *page = file_page_new (src->va, src->writable,
+			src->file.region, src->file.ofs, src->file.read_bytes);
+
+	if (page != NULL)
+		page->advice = src->advice;
+	return page;
+}
+
+/* Returns how much of the file PAGE's frame is keyed by in the
+ * page index: for text, the bytes read, and 0 for mappings. */
+static size_t
+text_bytes (struct page *page) {
+	return page->file.region->text ? page->file.read_bytes : 0;
+}
+
+/* Returns the frame in the page index that holds what PAGE maps,
+ * or NULL if there is none.  The frame lock must be held. */
+struct frame *
+file_page_lookup (struct page *page) {
+	struct frame key;
+	struct hash_elem *e;
+
+	key.inode = file_get_inode (page->file.region->file);
+	key.ofs = page->file.ofs;
+	key.text_bytes = text_bytes (page);
+	e = hash_find (&page_index, &key.index_elem);
+	if (e == NULL)
+		return NULL;
+	pages_shared++;
+	return hash_entry (e, struct frame, index_elem);
+}
+
+/* Writes PAGE's frame back to the file if PAGE, or any page that
+ * shares or shared the frame, wrote to it.  Returns false if the
+ * write fails. */
+static bool
+write_back (struct page *page) {
 	struct file_page *file_page = &page->file;
+	struct frame *frame = page->frame;
+
+	if (!frame->dirty && !pml4_is_dirty (page->pml4, page->va)
+			&& !frame_is_dirty (frame))
+		return true;
+
+	pages_written++;
+	return file_write_at (file_page->region->file, frame->kva,
+			file_page->read_bytes, file_page->ofs)
+		== (off_t) file_page->read_bytes;
+}
+
+/* qsort() comparison function for file_write_back(): orders
+ * frames by file, then offset. */
+static int
+frame_cmp (const void *a_, const void *b_) {
+	const struct frame *a = *(struct frame * const *) a_;
+	const struct frame *b = *(struct frame * const *) b_;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode ? -1 : 1;
+	return a->ofs < b->ofs ? -1 : a->ofs > b->ofs;
+}
+
+/* Writes back the CNT dirty frames in FRAMES, which hold parts of
+ * files, in order of file and offset, so that each run of
+ * consecutive pages goes out as one sweep of the file.  A frame
+ * written back is clean afterward.  The frame lock must be held. */
+void
+file_write_back (struct frame **frames, size_t cnt) {
+	size_t i;
+
+	qsort (frames, cnt, sizeof *frames, frame_cmp);
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame = frames[i];
+
+		if (i == 0 || frame->inode != frames[i - 1]->inode
+				|| frame->ofs != frames[i - 1]->ofs + PGSIZE)
+			batch_runs++;
+		if (write_back (frame->page)) {
+			frame->dirty = false;
+			frame_clear_dirty (frame);
+			batch_pages++;
+		}
+	}
+}
+
+/* Removes FRAME from the page index. */
+static void
+index_remove (struct frame *frame) {
+	hash_delete (&page_index, &frame->index_elem);
+	frame->inode = NULL;
+	frame->dirty = false;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	struct frame *frame = page->frame;
+
+	if (file_read_at (file_page->region->file, kva, file_page->read_bytes,
+				file_page->ofs) != (off_t) file_page->read_bytes)
+		return false;
+	memset (kva + file_page->read_bytes, 0, PGSIZE - file_page->read_bytes);
+	pages_read++;
+
+	frame->inode = file_get_inode (file_page->region->file);
+	frame->ofs = file_page->ofs;
+	frame->text_bytes = text_bytes (page);
+	frame->dirty = false;
+	hash_insert (&page_index, &frame->index_elem);
+	return true;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (!write_back (page))
+		return false;
+	index_remove (page->frame);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+	struct mmap_region *region = file_page->region;
+	struct frame *frame = page->frame;
+
+	/* PAGE has already left FRAME's pages.  If others remain, they
+	 * write the frame back later, on PAGE's behalf too. */
+	if (frame != NULL && frame->ref_cnt > 0) {
+		if (pml4_is_dirty (page->pml4, page->va))
+			frame->dirty = true;
+	} else if (frame != NULL) {
+		write_back (page);
+		index_remove (frame);
+	}
+
+	if (--region->page_cnt == 0) {
+		file_close (region->file);
+		free (region);
+	}
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct mmap_region *region;
+	off_t file_len = file_length (file);
+	size_t page_cnt, i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || offset % PGSIZE != 0
+			|| length == 0 || file_len == 0 || !is_user_vaddr (addr)
+			|| length > (uint64_t) KERN_BASE - (uint64_t) addr)
+		return NULL;
+
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	for (i = 0; i < page_cnt; i++)
+		if (spt_find_page (&thread_current ()->spt, addr + i * PGSIZE) != NULL)
+			return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = file_reopen (file);
+	region->page_cnt = 0;
+	region->text = false;
+	if (region->file == NULL) {
+		free (region);
+		return NULL;
+	}
+
+	for (i = 0; i < page_cnt; i++) {
+		off_t ofs = offset + i * PGSIZE;
+		size_t read_bytes = ofs < file_len ? file_len - ofs : 0;
+
+		if (read_bytes > PGSIZE)
+			read_bytes = PGSIZE;
+		if (file_page_new (addr + i * PGSIZE, writable, region, ofs,
+					read_bytes) == NULL) {
+			if (i > 0)
+				do_munmap (addr);
+			else {
+				file_close (region->file);
+				free (region);
+			}
+			return NULL;
+		}
+	}
+	return addr;
+}
+
+/* Maps the READ_BYTES bytes of a read-only program segment that
+ * start at OFS in FILE, at ADDR in the current process, zero-filled
+ * to the end of the last page.  Processes running the same program
+ * share the frames.  Returns false if memory runs out; pages mapped
+ * by then go away with the process. */
+bool
+do_mmap_text (struct file *file, off_t ofs, void *addr, size_t read_bytes) {
+	struct mmap_region *region;
+
+	ASSERT (pg_ofs (addr) == 0);
+	ASSERT (ofs % PGSIZE == 0);
+	ASSERT (read_bytes > 0);
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return false;
+	region->file = file_reopen (file);
+	region->page_cnt = 0;
+	region->text = true;
+	if (region->file == NULL) {
+		free (region);
+		return false;
+	}
+
+	while (read_bytes > 0) {
+		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+
+		if (file_page_new (addr, false, region, ofs, page_read_bytes) == NULL) {
+			if (region->page_cnt == 0) {
+				file_close (region->file);
+				free (region);
+			}
+			return false;
+		}
+		read_bytes -= page_read_bytes;
+		addr += PGSIZE;
+		ofs += PGSIZE;
+	}
+	return true;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page = spt_find_page (spt, addr);
+	struct mmap_region *region;
+	void *end;
+
+	if (page == NULL || VM_TYPE (page->operations->type) != VM_FILE
+			|| page->file.region->text)
+		return;
+
+	/* The region's pages follow one another.  What they wrote goes
+	 * out first, in one sorted pass. */
+	region = page->file.region;
+	for (end = addr + PGSIZE; ; end += PGSIZE) {
+		struct page *next = spt_find_page (spt, end);
+
+		if (next == NULL || VM_TYPE (next->operations->type) != VM_FILE
+				|| next->file.region != region)
+			break;
+	}
+	vm_write_back (spt, addr, end);
+
+	/* REGION is freed with the last of its pages, but only compared
+	 * against after that. */
+	while (page != NULL && VM_TYPE (page->operations->type) == VM_FILE
+			&& page->file.region == region) {
+		spt_remove_page (spt, page);
+		addr += PGSIZE;
+		page = spt_find_page (spt, addr);
+	}
+}
+
+/* Prints statistics about file-backed pages. */
+void
+vm_file_print_stats (void) {
+	printf ("File: %lld pages read, %lld found in the page index, "
+			"%lld written back, %lld of them at unmap or exit in %lld runs\n",
+			pages_read, pages_shared, pages_written, batch_pages, batch_runs);
 }
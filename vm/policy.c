@@ -0,0 +1,266 @@
+/* policy.c: Page-replacement policies.
+ *
+ * Each policy keeps the frames that hold pages in queues of its
+ * own, linked through their queue_elem, and reads the accessed
+ * bits of their mappings to judge how recently they were used.
+ * The policy is chosen with the kernel option -vmpolicy=NAME:
+ *
+ * - clock: second chance.  A hand sweeps the frames in a circle,
+ *   clearing accessed bits, and stops at the first frame whose
+ *   bit was already clear.  Clean frames are preferred during the
+ *   first revolution.  This is the default.
+ *
+ * - 2q: scan resistant, after 2Q and CLOCK-Pro.  New pages go on
+ *   a probation queue and are promoted to the protected queue
+ *   only when they are used again after a sweep of probation has
+ *   cleared their accessed bit.  A sequential scan therefore
+ *   cycles through probation without pushing the working set out
+ *   of the protected queue, which is capped at 3/4 of the frames.
+ *
+ * - fifo: evicts the page that was brought in first.
+ *
+ * - random: evicts a page chosen at random.  Finding it walks the
+ *   queue, so it costs time linear in the number of frames. */
+
+#include <random.h>
+#include <string.h>
+#include "vm/vm.h"
+#include "vm/policy.h"
+
+/* Queues shared by the policies.  Only 2q uses the second. */
+static struct list queue;               /* Clock, FIFO or probation. */
+static struct list protected;           /* 2q's protected queue. */
+static size_t queue_cnt;                /* Frames in QUEUE. */
+static size_t protected_cnt;            /* Frames in PROTECTED. */
+static struct list_elem *clock_hand;    /* Clock's next frame. */
+
+/* Returns true if FRAME may be evicted at all.  A shared frame is
+ * evicted from all of its pages at once, unless one of them is
+ * locked in memory. */
+static bool
+evictable (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->ref_cnt == 0 || frame->pinned)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (list_entry (e, struct page, frame_elem)->mlocked)
+			return false;
+	return true;
+}
+
+/* Appends FRAME to QUEUE. */
+static void
+queue_add (struct frame *frame) {
+	list_push_back (&queue, &frame->queue_elem);
+	queue_cnt++;
+}
+
+/* Removes FRAME from QUEUE. */
+static void
+queue_remove (struct frame *frame) {
+	list_remove (&frame->queue_elem);
+	queue_cnt--;
+}
+
+/* Clock. */
+
+/* Returns the frame after ELEM in clock order. */
+static struct list_elem *
+clock_next (struct list_elem *elem) {
+	elem = list_next (elem);
+	return elem != list_end (&queue) ? elem : list_begin (&queue);
+}
+
+/* Adds FRAME just behind the hand, so that it is the last one the
+ * hand reaches. */
+static void
+clock_add (struct frame *frame) {
+	if (clock_hand == NULL) {
+		list_push_back (&queue, &frame->queue_elem);
+		clock_hand = &frame->queue_elem;
+	} else
+		list_insert (clock_hand, &frame->queue_elem);
+	queue_cnt++;
+}
+
+static void
+clock_remove (struct frame *frame) {
+	if (clock_hand == &frame->queue_elem)
+		clock_hand = queue_cnt > 1 ? clock_next (clock_hand) : NULL;
+	queue_remove (frame);
+}
+
+/* Two revolutions are enough to find a victim, and on average the
+ * hand moves only a few frames per eviction. */
+static struct frame *
+clock_victim (void) {
+	struct frame *fallback = NULL;
+	size_t i;
+
+	for (i = 0; i < 2 * queue_cnt; i++) {
+		struct frame *frame = list_entry (clock_hand, struct frame,
+				queue_elem);
+
+		clock_hand = clock_next (clock_hand);
+		if (!evictable (frame) || frame_test_and_clear_accessed (frame))
+			continue;
+		if (i < queue_cnt && frame_is_dirty (frame)) {
+			if (fallback == NULL)
+				fallback = frame;
+			continue;
+		}
+		return frame;
+	}
+	return fallback;
+}
+
+/* 2Q. */
+
+/* Returns the largest number of frames the protected queue may
+ * hold. */
+static size_t
+protected_limit (void) {
+	return (queue_cnt + protected_cnt) * 3 / 4;
+}
+
+static void
+twoq_add (struct frame *frame) {
+	frame->protected = false;
+	frame->seen = false;
+	queue_add (frame);
+}
+
+static void
+twoq_remove (struct frame *frame) {
+	if (frame->protected) {
+		list_remove (&frame->queue_elem);
+		protected_cnt--;
+	} else
+		queue_remove (frame);
+}
+
+/* Moves the frame at the head of the protected queue to its tail
+ * if it was used since the last visit, or demotes it to probation
+ * otherwise. */
+static void
+twoq_age_protected (void) {
+	struct frame *frame = list_entry (list_pop_front (&protected),
+			struct frame, queue_elem);
+
+	if (frame->page != NULL && frame_test_and_clear_accessed (frame))
+		list_push_back (&protected, &frame->queue_elem);
+	else {
+		protected_cnt--;
+		frame->protected = false;
+		frame->seen = false;
+		queue_add (frame);
+	}
+}
+
+static struct frame *
+twoq_victim (void) {
+	size_t i;
+
+	for (i = 0; i < 3 * (queue_cnt + protected_cnt); i++) {
+		struct frame *frame;
+
+		if (protected_cnt > protected_limit () || list_empty (&queue)) {
+			if (list_empty (&protected))
+				break;
+			twoq_age_protected ();
+			continue;
+		}
+
+		/* Frames leave the head of probation one way or another:
+		 * evicted, promoted, or sent around once more. */
+		frame = list_entry (list_front (&queue), struct frame, queue_elem);
+		if (!evictable (frame)) {
+			list_push_back (&queue, list_pop_front (&queue));
+			continue;
+		}
+		if (!frame_test_and_clear_accessed (frame))
+			return frame;
+		if (frame->seen) {
+			queue_remove (frame);
+			frame->protected = true;
+			list_push_back (&protected, &frame->queue_elem);
+			protected_cnt++;
+		} else {
+			frame->seen = true;
+			list_push_back (&queue, list_pop_front (&queue));
+		}
+	}
+	return NULL;
+}
+
+/* FIFO. */
+
+static struct frame *
+fifo_victim (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&queue); e != list_end (&queue); e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, queue_elem);
+		if (evictable (frame))
+			return frame;
+	}
+	return NULL;
+}
+
+/* Random. */
+
+static struct frame *
+random_victim (void) {
+	struct list_elem *e;
+	size_t i;
+
+	if (queue_cnt == 0)
+		return NULL;
+
+	e = list_begin (&queue);
+	for (i = random_ulong () % queue_cnt; i > 0; i--)
+		e = list_next (e);
+	for (i = 0; i < queue_cnt; i++) {
+		struct frame *frame = list_entry (e, struct frame, queue_elem);
+		if (evictable (frame))
+			return frame;
+		e = list_next (e);
+		if (e == list_end (&queue))
+			e = list_begin (&queue);
+	}
+	return NULL;
+}
+
+static const struct vm_policy policies[] = {
+	{"clock", clock_add, clock_remove, clock_victim},
+	{"2q", twoq_add, twoq_remove, twoq_victim},
+	{"fifo", queue_add, queue_remove, fifo_victim},
+	{"random", queue_add, queue_remove, random_victim},
+};
+
+/* The policy in use. */
+const struct vm_policy *vm_policy = &policies[0];
+
+/* Initializes the policies' queues. */
+void
+vm_policy_init (void) {
+	list_init (&queue);
+	list_init (&protected);
+}
+
+/* Makes the policy called NAME the one in use.  Returns false if
+ * there is no such policy.  Must be called before any frame is
+ * added. */
+bool
+vm_policy_select (const char *name) {
+	size_t i;
+
+	for (i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (name != NULL && !strcmp (name, policies[i].name)) {
+			vm_policy = &policies[i];
+			return true;
+		}
+	return false;
+}
@@ -1,8 +1,117 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/policy.h"
+
+/* Shape of the supplemental page table's radix tree. */
+#define SPT_LEVELS 4                    /* Levels, like the page table. */
+#define SPT_FANOUT 512                  /* Entries per node. */
+
+/* Most pages the stack grows by at once, and most pages of gap
+   between the stack and a fault below it that growing fills in. */
+#define STACK_CHUNK_MAX 16
+#define STACK_GAP_MAX 64
+
+/* Most pages one process may lock in memory with mlock(). */
+#define MLOCK_MAX 64
+
+/* The frame table: every frame allocated for user pages.  Which
+   of them to evict is up to the replacement policy; see policy.c.
+   FRAME_LOCK protects the table, the policy's queues, and the
+   frame and residency of every page, and is held across a page's
+   swap-in and swap-out so that neither races with the other.  The
+   one exception is kswapd, which lets go of it while it writes out
+   anonymous pages, so that faults that find a free frame need not
+   wait for the disk; see kswapd_evict().  The frames it is writing
+   out are marked IO, and anyone who needs one of their pages waits
+   on FRAME_IO_DONE.
+
+   Fork shares the parent's resident anonymous pages with the child
+   instead of copying them.  Each of the pages sharing a frame maps
+   it read-only, and the first write to one of them gets it a copy
+   of its own in vm_handle_wp(); the last page left on the frame
+   just gets write access back.  A shared frame is evicted from all
+   of its pages at once, through the frame's reverse map, and they
+   share its copy in swap until one of them faults it back in.
+
+   With -ksm=N, a kernel thread also merges anonymous frames that
+   hold the same contents into one, shared copy-on-write just like
+   after fork; see ksm_daemon().
+
+   Frames are normally evicted by the faulting thread itself, when
+   the user pool runs dry.  With -kswapd=LOW,HIGH, a kernel thread
+   starts evicting as soon as fewer than LOW user pages are free,
+   and goes on until HIGH are, so that most faults find a free
+   frame waiting; see kswapd(). */
+static struct list frame_table;
+static struct lock frame_lock;
+static struct condition frame_io_done;
+
+/* A frame of zeros, outside the frame table.  Reading anonymous
+   memory that was never written maps it read-only instead of
+   allocating and clearing a frame; the first write gets the page
+   a frame of its own. */
+static struct frame zero_frame;
+
+/* Statistics. */
+static long long fault_cnt;             /* Faults that claimed a page. */
+static long long evict_cnt;             /* Pages evicted. */
+static long long reload_cnt;            /* Evicted pages brought back. */
+static long long cow_copy_cnt;          /* Shared pages copied on write. */
+static long long cow_reuse_cnt;         /* Pages written in place. */
+static long long zero_map_cnt;          /* Reads served by ZERO_FRAME. */
+static long long around_cnt;            /* Pages mapped around faults. */
+static long long stack_fault_cnt;       /* Faults that grew the stack. */
+static long long stack_page_cnt;        /* Pages the stack grew by. */
+static long long ksm_scan_cnt;          /* Frames scanned for merging. */
+static long long ksm_page_cnt;          /* Pages moved to merged frames. */
+static long long ksm_frame_cnt;         /* Frames freed by merging. */
+static long long kswapd_wake_cnt;       /* Times kswapd was woken. */
+static long long kswapd_evict_cnt;      /* Pages evicted by kswapd. */
+
+size_t vm_fault_around_max = 16;
+size_t vm_stack_max = 256;
+size_t vm_stack_initial = 4;
+size_t vm_ksm_pages;
+size_t vm_reclaim_low;
+size_t vm_reclaim_high;
+
+/* Pages locked in memory by mlock(), in all processes, and the
+   most there may be: a quarter of the user pool as it was at
+   boot, so that locked pages never leave too little to evict. */
+static size_t mlock_cnt;
+static size_t mlock_max;
+
+/* Wakes up kswapd, if it is not at work already. */
+static struct semaphore kswapd_sema;
+static bool kswapd_pending;
+
+/* Same-page merging: the frames that may be merged with others,
+   by the hash of their contents, and the next frame to scan. */
+static struct hash ksm_table;
+static struct list_elem *ksm_cursor;
+
+/* Ticks between two passes of same-page merging, and frames to
+   scan between two chances for other threads to take FRAME_LOCK. */
+#define KSM_INTERVAL (TIMER_FREQ / 10)
+#define KSM_BATCH 32
+
+static bool vm_move_frame (void *old_page, void *new_page);
+static hash_hash_func ksm_hash;
+static hash_less_func ksm_less;
+static void ksm_daemon (void *aux);
+static void kswapd (void *aux);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +124,24 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	lock_init (&frame_lock);
+	cond_init (&frame_io_done);
+	vm_policy_init ();
+	palloc_set_mover (vm_move_frame);
+
+	zero_frame.kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	list_init (&zero_frame.pages);
+	zero_frame.pinned = true;
+	mlock_max = palloc_user_free () / 4;
+
+	hash_init (&ksm_table, ksm_hash, ksm_less, NULL);
+	if (vm_ksm_pages > 0)
+		thread_create ("ksmd", PRI_MIN, ksm_daemon, NULL);
+
+	sema_init (&kswapd_sema, 0);
+	if (vm_reclaim_low > 0)
+		thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,6 +161,7 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool claim_page_locked (struct page *page);
 static struct frame *vm_evict_frame (void);
 
 /* Create the pending page object with initializer. If you want to create a
@@ -47,97 +174,964 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
 
 	/* Check wheter the upage is already occupied or not. */
-	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+	if (spt_find_page (spt, upage) != NULL)
+		goto err;
+
+	switch (VM_TYPE (type)) {
+		case VM_ANON:
+			initializer = anon_initializer;
+			break;
+		case VM_FILE:
+			initializer = file_backed_initializer;
+			break;
+		default:
+			goto err;
+	}
+
+	page = malloc (sizeof *page);
+	if (page == NULL)
+		goto err;
+	uninit_new (page, upage, init, type, aux, initializer);
+	page->writable = writable;
+	page->pml4 = thread_current ()->pml4;
 
-		/* TODO: Insert the page into the spt. */
+	if (!spt_insert_page (spt, page)) {
+		free (page);
+		goto err;
 	}
+	return true;
+
 err:
 	return false;
 }
 
+/* Returns the index of VA within a node at LEVEL of the
+ * supplemental page table.  Level 0 holds the pages. */
+static inline size_t
+spt_index (uint64_t va, int level) {
+	return (va >> (PTXSHIFT + 9 * level)) & (SPT_FANOUT - 1);
+}
+
+/* Allocates an empty node of the supplemental page table. */
+static void **
+spt_node_create (void) {
+	return palloc_get_page (PAL_ZERO);
+}
+
+/* Returns true if NODE has no entries. */
+static bool
+spt_node_empty (void **node) {
+	for (size_t i = 0; i < SPT_FANOUT; i++)
+		if (node[i] != NULL)
+			return false;
+	return true;
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	void **node = spt->root;
+	int level;
 
-	return page;
+	for (level = SPT_LEVELS - 1; level > 0 && node != NULL; level--)
+		node = node[spt_index ((uint64_t) va, level)];
+	return node != NULL ? node[spt_index ((uint64_t) va, 0)] : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	uint64_t va = (uint64_t) page->va;
+	void ***slot = &spt->root;
+	int level;
 
-	return succ;
+	if (pg_ofs (page->va) != 0 || !is_user_vaddr (page->va))
+		return false;
+
+	for (level = SPT_LEVELS - 1; level >= 0; level--) {
+		if (*slot == NULL && (*slot = spt_node_create ()) == NULL)
+			return false;
+		if (level > 0)
+			slot = (void ***) &(*slot)[spt_index (va, level)];
+	}
+
+	void **leaf = &(*slot)[spt_index (va, 0)];
+	if (*leaf != NULL)
+		return false;
+	*leaf = page;
+	spt->page_cnt++;
+	return true;
 }
 
+/* Removes the entry for VA from SPT, freeing the nodes that
+ * become empty. */
+static void
+spt_unlink (struct supplemental_page_table *spt, uint64_t va) {
+	void **path[SPT_LEVELS];
+	void **node = spt->root;
+	int level;
+
+	for (level = SPT_LEVELS - 1; level >= 0; level--) {
+		ASSERT (node != NULL);
+		path[level] = node;
+		if (level > 0)
+			node = node[spt_index (va, level)];
+	}
+
+	path[0][spt_index (va, 0)] = NULL;
+	spt->page_cnt--;
+
+	for (level = 0; level < SPT_LEVELS && spt_node_empty (path[level]);
+			level++) {
+		palloc_free_page (path[level]);
+		if (level + 1 < SPT_LEVELS)
+			path[level + 1][spt_index (va, level + 1)] = NULL;
+		else
+			spt->root = NULL;
+	}
+}
+
+/* Adds PAGE to the pages sharing FRAME.  The frame lock must be
+ * held. */
 void
-spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+frame_link (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->ref_cnt++;
+	frame->page = list_entry (list_front (&frame->pages), struct page,
+			frame_elem);
+	page->frame = frame;
+}
+
+/* Removes PAGE from the pages sharing FRAME.  PAGE->frame is left
+ * for the caller to clear.  The frame lock must be held. */
+static void
+frame_unlink (struct frame *frame, struct page *page) {
+	list_remove (&page->frame_elem);
+	frame->ref_cnt--;
+	frame->page = frame->ref_cnt > 0
+		? list_entry (list_front (&frame->pages), struct page, frame_elem)
+		: NULL;
+}
+
+/* Maps PAGE to its frame in its page table.  A frame shared
+ * copy-on-write is mapped read-only; one that holds part of a file
+ * is writable by all the pages that may write to it. */
+static bool
+frame_map (struct page *page) {
+	struct frame *frame = page->frame;
+
+	return pml4_set_page (page->pml4, page->va, frame->kva, page->writable
+			&& (frame->ref_cnt == 1 || frame->inode != NULL));
+}
+
+/* Tests and clears the accessed bits of the pages sharing FRAME.
+ * Returns true if any of them was set. */
+bool
+frame_test_and_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->pml4, page->va)) {
+			pml4_set_accessed (page->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if any page sharing FRAME has written to it.  An
+ * unmapped PTE keeps its dirty bit, so this still works after
+ * frame_unmap(). */
+bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_dirty (page->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Clears the dirty bits of the pages sharing FRAME, once it has
+ * been written back. */
+void
+frame_clear_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_set_dirty (page->pml4, page->va, false);
+	}
+}
+
+/* Unmaps every page sharing FRAME. */
+static void
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_clear_page (page->pml4, page->va);
+	}
+}
+
+/* Maps every page sharing FRAME, unmapped by frame_unmap(), to KVA
+ * instead, keeping the accessed and dirty bits that the unmapped
+ * PTEs still hold.  Returns false if a mapping could not be made. */
+static bool
+frame_remap (struct frame *frame, void *kva) {
+	struct list_elem *e;
+
+	frame->kva = kva;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		bool accessed = pml4_is_accessed (page->pml4, page->va);
+		bool dirty = pml4_is_dirty (page->pml4, page->va);
+
+		if (!frame_map (page))
+			return false;
+		pml4_set_accessed (page->pml4, page->va, accessed);
+		pml4_set_dirty (page->pml4, page->va, dirty);
+	}
+	return true;
+}
+
+/* Returns a new frame for KVA, a user page, holding no page yet,
+ * or NULL if memory runs out.  The frame lock must be held. */
+static struct frame *
+frame_new (void *kva) {
+	struct frame *frame = malloc (sizeof *frame);
+
+	if (frame == NULL)
+		return NULL;
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->ref_cnt = 0;
+	frame->pinned = false;
+	frame->io = false;
+	frame->inode = NULL;
+	frame->dirty = false;
+	frame->ksm_hash = 0;
+	frame->ksm_listed = false;
+	list_push_back (&frame_table, &frame->elem);
+	return frame;
+}
+
+/* Takes FRAME out of the table of frames that same-page merging
+ * may merge others into. */
+static void
+ksm_forget (struct frame *frame) {
+	if (frame->ksm_listed) {
+		hash_delete (&ksm_table, &frame->ksm_elem);
+		frame->ksm_listed = false;
+	}
+}
+
+/* Removes FRAME, which holds no page, from the frame table and
+ * frees it.  The frame lock must be held. */
+static void
+frame_free (struct frame *frame) {
+	ASSERT (frame->ref_cnt == 0);
+
+	ksm_forget (frame);
+	if (ksm_cursor == &frame->elem)
+		ksm_cursor = list_next (ksm_cursor);
+	list_remove (&frame->elem);
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Waits until PAGE's frame, if any, is not being written out by
+ * kswapd, letting go of the frame lock meanwhile.  PAGE may have
+ * been evicted by then.  The frame lock must be held. */
+static void
+frame_wait_io (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while (page->frame != NULL && page->frame->io)
+		cond_wait (&frame_io_done, &frame_lock);
+}
+
+/* Frees PAGE, which is no longer in any supplemental page table,
+ * along with its frame unless other pages still share it. */
+static void
+spt_release_page (struct page *page) {
+	struct frame *frame;
+	uint64_t *pml4 = page->pml4;
+	void *va = page->va;
+
+	lock_acquire (&frame_lock);
+	frame_wait_io (page);
+	if (page->mlocked)
+		mlock_cnt--;
+	frame = page->frame;
+	if (frame == &zero_frame) {
+		pml4_clear_page (pml4, va);
+		frame = NULL;
+	} else if (frame != NULL)
+		frame_unlink (frame, page);
 	vm_dealloc_page (page);
+	if (frame != NULL) {
+		pml4_clear_page (pml4, va);
+		if (frame->ref_cnt == 0) {
+			vm_policy->remove (frame);
+			frame_free (frame);
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+void
+spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (spt_find_page (spt, page->va) == page);
+
+	spt_unlink (spt, (uint64_t) page->va);
+	if (page->mlocked)
+		spt->mlock_cnt--;
+	spt_release_page (page);
+}
+
+/* Returns the first page at or above VA within NODE, a node at
+ * LEVEL whose range contains VA, or NULL if there is none. */
+static struct page *
+spt_node_next (void **node, int level, uint64_t va) {
+	int shift = PTXSHIFT + 9 * level;
+
+	for (size_t i = spt_index (va, level); i < SPT_FANOUT;
+			i++, va = ((va >> shift) + 1) << shift) {
+		if (node[i] == NULL)
+			continue;
+		if (level == 0)
+			return node[i];
+
+		struct page *page = spt_node_next (node[i], level - 1, va);
+		if (page != NULL)
+			return page;
+	}
+	return NULL;
+}
+
+/* Returns the page with the lowest address at or above VA in SPT,
+ * or NULL if there is none.  Empty subtrees are skipped whole, so
+ * stepping through a sparse address space stays cheap. */
+struct page *
+spt_next_page (struct supplemental_page_table *spt, void *va) {
+	if (spt->root == NULL || !is_user_vaddr (va))
+		return NULL;
+	return spt_node_next (spt->root, SPT_LEVELS - 1, (uint64_t) va);
+}
+
+/* Calls FUNC for each page in SPT whose address lies in
+ * [START, END), in ascending address order, passing AUX along.
+ * FUNC may remove the page it is given.  Stops and returns false
+ * as soon as FUNC returns false; returns true otherwise. */
+bool
+spt_for_each (struct supplemental_page_table *spt, void *start, void *end,
+		spt_for_each_func *func, void *aux) {
+	struct page *page;
+
+	for (page = spt_next_page (spt, start);
+			page != NULL && page->va < end; ) {
+		void *next = page->va + PGSIZE;
+
+		if (!func (page, aux))
+			return false;
+		page = spt_next_page (spt, next);
+	}
 	return true;
 }
 
+/* Returns a new description of a page whose contents come from
+ * READ_BYTES bytes of FILE at OFS, or NULL if memory runs out. */
+struct load_info *
+load_info_new (struct file *file, off_t ofs, size_t read_bytes) {
+	ASSERT (read_bytes <= PGSIZE);
+
+	struct load_info *info = malloc (sizeof *info);
+	if (info == NULL)
+		return NULL;
+	info->file = file_reopen (file);
+	if (info->file == NULL) {
+		free (info);
+		return NULL;
+	}
+	info->ofs = ofs;
+	info->read_bytes = read_bytes;
+	return info;
+}
+
+/* Returns a copy of INFO with its own file, or NULL if memory
+ * runs out. */
+struct load_info *
+load_info_copy (const struct load_info *info) {
+	return load_info_new (info->file, info->ofs, info->read_bytes);
+}
+
+/* Frees INFO and closes its file. */
+void
+load_info_free (struct load_info *info) {
+	if (info != NULL) {
+		file_close (info->file);
+		free (info);
+	}
+}
+
+/* Page initializer that fills PAGE as described by AUX, a struct
+ * load_info, which it frees. */
+bool
+vm_load_file_page (struct page *page, void *aux) {
+	struct load_info *info = aux;
+	uint8_t *kva = page->frame->kva;
+	bool success;
+
+	success = file_read_at (info->file, kva, info->read_bytes, info->ofs)
+		== (off_t) info->read_bytes;
+	memset (kva + info->read_bytes, 0, PGSIZE - info->read_bytes);
+	load_info_free (info);
+	return success;
+}
+
 /* Get the struct frame, that will be evicted. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	return vm_policy->victim ();
+}
+
+/* Takes FRAME off the replacement queues and unmaps its pages,
+ * ahead of evict_frames(), so that their owners cannot change it
+ * while it is written out. */
+static void
+evict_prepare (struct frame *frame) {
+	vm_policy->remove (frame);
+	frame_unmap (frame);
+}
+
+/* Finishes evicting VICTIM, which has been through
+ * evict_prepare(): if WRITTEN, its contents are out and its pages
+ * let go of it, leaving it empty; otherwise they are mapped to it
+ * again.  Returns WRITTEN.  A frame shared by several pages is
+ * written out once for all of them, which the frame's reverse map
+ * lets go of together. */
+static bool
+evict_finish (struct frame *victim, bool written) {
+	if (!written) {
+		frame_remap (victim, victim->kva);
+		vm_policy->add (victim);
+		return false;
+	}
+	while (victim->ref_cnt > 0) {
+		struct page *page = victim->page;
+
+		frame_unlink (victim, page);
+		page->frame = NULL;
+	}
+	ksm_forget (victim);
+	evict_cnt++;
+	return true;
+}
+
+/* Writes out the contents of the CNT frames in VICTIMS, which have
+ * been through evict_prepare(), and frees all but the first frame
+ * that was emptied.  Returns that frame, or NULL if nothing could
+ * be written out; those frames are mapped again.  The anonymous
+ * pages go to swap in one sequential burst. */
+static struct frame *
+evict_frames (struct frame **victims, size_t cnt) {
+	struct frame *frame = NULL;
+	size_t i;
 
-	return victim;
+	swap_cluster_begin (cnt);
+	for (i = 0; i < cnt; i++) {
+		struct frame *victim = victims[i];
+
+		if (!evict_finish (victim, swap_out (victim->page)))
+			continue;
+		if (frame == NULL)
+			frame = victim;
+		else
+			frame_free (victim);
+	}
+	swap_cluster_end ();
+	return frame;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ *
+ * Pages are evicted in batches of up to SWAP_CLUSTER; the frames
+ * beyond the one returned go back to the user pool. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victims[SWAP_CLUSTER];
+	size_t cnt;
 
-	return NULL;
+	for (cnt = 0; cnt < SWAP_CLUSTER; cnt++) {
+		struct frame *victim = vm_get_victim ();
+		if (victim == NULL)
+			break;
+		evict_prepare (victim);
+		victims[cnt] = victim;
+	}
+	return evict_frames (victims, cnt);
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  Returns NULL only if neither works.  The frame
+ * lock must be held. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct frame *frame;
+	void *kva;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	kva = palloc_get_page (PAL_USER);
+	if (vm_reclaim_low > 0 && !kswapd_pending
+			&& palloc_user_free () < vm_reclaim_low) {
+		kswapd_pending = true;
+		sema_up (&kswapd_sema);
+	}
+	if (kva == NULL)
+		return vm_evict_frame ();
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	frame = frame_new (kva);
+	if (frame == NULL)
+		palloc_free_page (kva);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Evicts a batch of up to SWAP_CLUSTER frames for kswapd and frees
+ * them.  Frames of file pages are written back as by any eviction.
+ * Those of anonymous pages are unmapped and marked IO, and the
+ * frame lock is let go while they go to swap: faults that find a
+ * free frame go ahead meanwhile, and only those on the pages being
+ * written out wait, in frame_wait_io().  Returns false if nothing
+ * could be evicted.  The frame lock must be held. */
+static bool
+kswapd_evict (void) {
+	struct frame *files[SWAP_CLUSTER], *anons[SWAP_CLUSTER];
+	bool written[SWAP_CLUSTER];
+	size_t file_cnt = 0, anon_cnt = 0, i;
+	struct frame *frame;
+	bool evicted = false;
+
+	while (file_cnt + anon_cnt < SWAP_CLUSTER) {
+		struct frame *victim = vm_get_victim ();
+
+		if (victim == NULL)
+			break;
+		evict_prepare (victim);
+		if (VM_TYPE (victim->page->operations->type) == VM_ANON)
+			anons[anon_cnt++] = victim;
+		else
+			files[file_cnt++] = victim;
+	}
+	if (file_cnt > 0 && (frame = evict_frames (files, file_cnt)) != NULL) {
+		frame_free (frame);
+		evicted = true;
+	}
+	if (anon_cnt == 0)
+		return evicted;
+
+	for (i = 0; i < anon_cnt; i++)
+		anons[i]->pinned = anons[i]->io = true;
+	lock_release (&frame_lock);
+	swap_cluster_begin (anon_cnt);
+	for (i = 0; i < anon_cnt; i++)
+		written[i] = swap_out (anons[i]->page);
+	swap_cluster_end ();
+	lock_acquire (&frame_lock);
+
+	for (i = 0; i < anon_cnt; i++) {
+		anons[i]->pinned = anons[i]->io = false;
+		if (evict_finish (anons[i], written[i])) {
+			frame_free (anons[i]);
+			evicted = true;
+		}
+	}
+	cond_broadcast (&frame_io_done, &frame_lock);
+	return evicted;
+}
+
+/* Background reclaim.  Woken by vm_get_frame() when fewer than
+ * vm_reclaim_low user pages are free, evicts a batch at a time
+ * until vm_reclaim_high are, or nothing more can be evicted.  The
+ * frame lock is not held while anonymous pages are written out;
+ * see kswapd_evict(). */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_sema);
+		kswapd_wake_cnt++;
+
+		lock_acquire (&frame_lock);
+		while (palloc_user_free () < vm_reclaim_high) {
+			long long before = evict_cnt;
+
+			if (!kswapd_evict ())
+				break;
+			kswapd_evict_cnt += evict_cnt - before;
+		}
+		kswapd_pending = false;
+		lock_release (&frame_lock);
+	}
+}
+
+/* Moves the user frame at OLD_PAGE to NEW_PAGE for palloc's
+ * compaction; see palloc_set_mover().  Finding the frame is a
+ * linear search, which is fine for how rarely compaction runs. */
+static bool
+vm_move_frame (void *old_page, void *new_page) {
+	struct list_elem *e;
+	bool moved = false;
+
+	if (lock_held_by_current_thread (&frame_lock)
+			|| !lock_try_acquire (&frame_lock))
+		return false;
+
+	for (e = list_begin (&frame_table); e != list_end (&frame_table);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+
+		if (frame->kva != old_page)
+			continue;
+		if (frame->page == NULL || frame->pinned)
+			break;
+
+		/* Unmapped, the pages fault and wait for the frame lock
+		 * instead of writing the frame while it is copied. */
+		frame_unmap (frame);
+		copy_page (new_page, old_page);
+		moved = frame_remap (frame, new_page);
+		if (!moved)
+			frame_remap (frame, old_page);
+		break;
+	}
+	lock_release (&frame_lock);
+	return moved;
+}
+
+/* Returns true if a fault at ADDR, with the user stack pointer
+ * at RSP, is an access to the stack that should grow it. */
+static bool
+is_stack_access (void *addr, void *rsp) {
+	return addr < (void *) USER_STACK
+		&& addr >= (void *) (USER_STACK - vm_stack_max * PGSIZE)
+		&& addr >= rsp - 8;
+}
+
+/* Growing the stack.  Adds stack pages from the bottom of the stack
+ * down to ADDR, and a chunk more below it.  The chunk doubles, up
+ * to STACK_CHUNK_MAX pages, each time the stack grows again right
+ * below where it last grew, so a program that recurses deep takes
+ * a fault per chunk instead of per page; a fault anywhere else
+ * starts it over at one page.  A fault more than STACK_GAP_MAX
+ * pages below the stack leaves the gap above it empty, to be
+ * filled a fault at a time if it is ever used, so that one fault
+ * cannot allocate a page for all of user space.  The pages are
+ * lazy; the caller maps those below ADDR with vm_stack_prefault()
+ * once ADDR is in. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *limit = (void *) (USER_STACK - vm_stack_max * PGSIZE);
+	void *va = pg_round_down (addr);
+	void *low, *start;
+	size_t i, cnt;
+
+	if (va == spt->stack_bottom - PGSIZE) {
+		spt->stack_chunk *= 2;
+		if (spt->stack_chunk > STACK_CHUNK_MAX)
+			spt->stack_chunk = STACK_CHUNK_MAX;
+	} else
+		spt->stack_chunk = 1;
+	low = va - (spt->stack_chunk - 1) * PGSIZE;
+	if (low < limit || low > va)
+		low = limit;
+
+	/* Pages in the way, such as mappings, are left as they are.
+	 * Counting pages instead of comparing addresses keeps the loop
+	 * from wrapping around when LOW is page 0. */
+	start = va < spt->stack_bottom
+			&& spt->stack_bottom - va <= STACK_GAP_MAX * PGSIZE
+		? spt->stack_bottom - PGSIZE : va;
+	cnt = (start - low) / PGSIZE + 1;
+	for (i = 0; i < cnt; i++)
+		if (vm_alloc_page (VM_ANON | VM_STACK, start - i * PGSIZE, true))
+			stack_page_cnt++;
+	if (low < spt->stack_bottom)
+		spt->stack_bottom = low;
+	stack_fault_cnt++;
+}
+
+/* Returns true if PAGE is anonymous memory that was never written,
+ * so that it holds nothing but zeros. */
+static bool
+is_zero_page (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Maps PAGE, which must satisfy is_zero_page(), read-only to the
+ * zero frame.  The frame lock must be held. */
+static bool
+vm_map_zero_page (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (!pml4_set_page (page->pml4, page->va, zero_frame.kva, false))
+		return false;
+	page->frame = &zero_frame;
+	zero_map_cnt++;
+	return true;
+}
+
+/* Maps PAGE, a file-backed page that is not resident, to the frame
+ * that already holds what it maps, if there is one, and returns
+ * true; returns false otherwise.  The frame lock must be held. */
+static bool
+share_file_frame (struct page *page) {
+	struct frame *frame;
+
+	if (VM_TYPE (page->operations->type) != VM_FILE)
+		return false;
+	frame = file_page_lookup (page);
+	if (frame == NULL)
+		return false;
+	frame_link (frame, page);
+	if (!frame_map (page)) {
+		frame_unlink (frame, page);
+		page->frame = NULL;
+		return false;
+	}
+	return true;
+}
+
+/* Brings PAGE, which is not resident, into free memory and maps
+ * it.  Never evicts, since nobody has asked for PAGE yet.  Returns
+ * false if there is no free frame or PAGE cannot be read.  The
+ * frame lock must be held. */
+static bool
+prefetch_page (struct page *page) {
+	struct frame *frame;
+	void *kva;
+
+	if (share_file_frame (page))
+		return true;
+	kva = vm_prefetch_begin (page);
+	if (kva == NULL)
+		return false;
+	if (!swap_in (page, kva)) {
+		frame = page->frame;
+		frame_unlink (frame, page);
+		page->frame = NULL;
+		frame_free (frame);
+		return false;
+	}
+	vm_prefetch_end (page);
+	return true;
+}
+
+/* Maps PAGE, a neighbor of a page that just faulted, if its
+ * contents are at hand without I/O: resident, possibly in a frame
+ * that another mapping of the same file brought in, all zeros, or
+ * compressed in zswap.  Neighbors of a write fault that are still
+ * zeros get frames of their own, from free memory only; those of a
+ * read fault share the zero frame.  Returns false if PAGE would
+ * need I/O or memory is short.  The frame lock must be held. */
+static bool
+fault_around_page (struct page *page, bool write) {
+	bool private = write && page->writable;
+
+	if (page->frame == &zero_frame) {
+		if (!private)
+			return true;
+		pml4_clear_page (page->pml4, page->va);
+		page->frame = NULL;
+	} else if (page->frame != NULL) {
+		if (page->frame->io)
+			return false;
+		if (pml4_get_page (page->pml4, page->va) != NULL)
+			return true;
+		if (!frame_map (page))
+			return false;
+		around_cnt++;
+		return true;
+	} else if (is_zero_page (page) && !private) {
+		if (!vm_map_zero_page (page))
+			return false;
+		around_cnt++;
+		return true;
+	} else if (share_file_frame (page)) {
+		around_cnt++;
+		return true;
+	} else if (!is_zero_page (page)
+			&& (VM_TYPE (page->operations->type) != VM_ANON
+				|| page->anon.zentry == NULL))
+		return false;
+
+	if (!prefetch_page (page))
+		return false;
+	around_cnt++;
+	return true;
+}
+
+/* Maps the stack pages between the bottom of the stack and VA, the
+ * lowest page in use, from VA down, as far as fault_around_page()
+ * can do so cheaply: they are where the stack grows next. */
+static void
+vm_stack_prefault (struct supplemental_page_table *spt, void *va) {
+	lock_acquire (&frame_lock);
+	while (va > spt->stack_bottom) {
+		struct page *page;
+
+		va -= PGSIZE;
+		page = spt_find_page (spt, va);
+		if (page == NULL || !fault_around_page (page, true))
+			break;
+	}
+	lock_release (&frame_lock);
+}
+
+/* After a fault on PAGE, maps the pages that follow it, as far as
+ * fault_around_page() can do so cheaply, so that a program walking
+ * through memory takes one fault per window instead of one per
+ * page.  The window doubles, up to vm_fault_around_max pages, each
+ * time a fault lands right after the pages mapped around the last
+ * one, and halves when a fault lands outside them. */
+static void
+vm_fault_around (struct supplemental_page_table *spt, struct page *page,
+		bool write) {
+	void *va = page->va;
+	size_t i;
+
+	if (page->advice == MADV_RANDOM)
+		return;
+	if (page->advice == MADV_SEQUENTIAL)
+		spt->around_window = vm_fault_around_max;
+	else if (va == spt->around_end)
+		spt->around_window = spt->around_window > 0
+			? spt->around_window * 2 : 1;
+	else if (va < spt->around_start || va > spt->around_end)
+		spt->around_window /= 2;
+	if (spt->around_window > vm_fault_around_max)
+		spt->around_window = vm_fault_around_max;
+
+	spt->around_start = va;
+	va += PGSIZE;
+	lock_acquire (&frame_lock);
+	for (i = 0; i < spt->around_window && is_user_vaddr (va);
+			i++, va += PGSIZE) {
+		struct page *next = spt_find_page (spt, va);
+
+		if (next == NULL || !fault_around_page (next, write))
+			break;
+	}
+	lock_release (&frame_lock);
+	spt->around_end = va;
 }
 
 /* Handle the fault on write_protected page */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *old, *frame;
+	bool success = true;
+
+	lock_acquire (&frame_lock);
+	old = page->frame;
+	if (old == NULL || old->io) {
+		/* Evicted meanwhile, or being evicted by kswapd and unmapped
+		 * already; the next fault brings it back. */
+	} else if (old == &zero_frame) {
+		success = claim_page_locked (page);
+		if (success)
+			fault_cnt++;
+	} else if (old->ref_cnt == 1) {
+		pml4_set_writable (page->pml4, page->va, true);
+		cow_reuse_cnt++;
+	} else {
+		/* Getting a frame may evict, so keep OLD from moving. */
+		old->pinned = true;
+		frame = vm_get_frame ();
+		old->pinned = false;
+		if (frame == NULL)
+			success = false;
+		else {
+			copy_page (frame->kva, old->kva);
+			frame_unlink (old, page);
+			frame_link (frame, page);
+			success = frame_map (page);
+			vm_policy->add (frame);
+			cow_copy_cnt++;
+		}
+	}
+	lock_release (&frame_lock);
+	return success;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+	bool grown = false;
+	bool success;
 
-	return vm_do_claim_page (page);
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (page == NULL) {
+		/* A kernel fault has the kernel's stack pointer in F, so
+		 * use the one saved on entry to the system call. */
+		void *rsp = user ? (void *) f->rsp : thread_current ()->user_rsp;
+
+		if (!not_present || !is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (spt, addr);
+		if (page == NULL)
+			return false;
+		grown = true;
+	}
+
+	if (write && !page->writable)
+		return false;
+	if (!not_present)
+		success = write && vm_handle_wp (page);
+	else if (!write && is_zero_page (page)) {
+		lock_acquire (&frame_lock);
+		success = vm_map_zero_page (page);
+		lock_release (&frame_lock);
+	} else {
+		success = vm_do_claim_page (page);
+		if (success)
+			fault_cnt++;
+	}
+	if (success && vm_fault_around_max > 0)
+		vm_fault_around (spt, page, write);
+	if (success && grown)
+		vm_stack_prefault (spt, page->va);
+	return success;
 }
 
 /* Free the page.
@@ -150,41 +1144,667 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Sets up the current process's stack: vm_stack_initial pages
+ * below USER_STACK, the top one claimed and the others mapped as
+ * far as free memory goes, so that a program does not start with
+ * a fault per page of stack it uses. */
+bool
+vm_setup_stack (void) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *top = (void *) (USER_STACK - PGSIZE);
+	size_t cnt = vm_stack_initial < vm_stack_max ? vm_stack_initial
+		: vm_stack_max;
+	size_t i;
+
+	if (cnt == 0)
+		cnt = 1;
+	for (i = 0; i < cnt; i++) {
+		if (!vm_alloc_page (VM_ANON | VM_STACK, top - i * PGSIZE, true))
+			return false;
+		spt->stack_bottom = top - i * PGSIZE;
+	}
+	if (!vm_claim_page (top))
+		return false;
+	vm_stack_prefault (spt, top);
+	return true;
+}
+
+/* Brings PAGE into a frame, if it is not in one yet, and maps it
+ * in its page table.  The frame lock must be held. */
 static bool
-vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+claim_page_locked (struct page *page) {
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	frame_wait_io (page);
+
+	/* On the zero frame, the page gets a frame of its own. */
+	if (page->frame == &zero_frame) {
+		pml4_clear_page (page->pml4, page->va);
+		page->frame = NULL;
+	}
+
+	/* Already resident, perhaps read ahead without a mapping. */
+	if (page->frame != NULL)
+		return pml4_get_page (page->pml4, page->va) != NULL
+			|| frame_map (page);
+	if (share_file_frame (page))
+		return true;
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_link (frame, page);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (VM_TYPE (page->operations->type) == VM_ANON)
+		reload_cnt++;
+	if (!swap_in (page, frame->kva)) {
+		frame_unlink (frame, page);
+		page->frame = NULL;
+		frame_free (frame);
+		return false;
+	}
 
-	return swap_in (page, frame->kva);
+	/* Mapped only now, since swapping in may have brought back
+	 * other pages to share the frame with. */
+	vm_policy->add (frame);
+	return frame_map (page);
+}
+
+/* Starts reading ahead PAGE, which is not resident: puts it in a
+ * free frame, if there is one, and returns the frame's kernel
+ * address, or NULL.  The caller fills the frame, then calls
+ * vm_prefetch_end().  The frame lock must be held. */
+void *
+vm_prefetch_begin (struct page *page) {
+	struct frame *frame;
+	void *kva;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->frame == NULL);
+
+	kva = palloc_get_page (PAL_USER);
+	if (kva == NULL)
+		return NULL;
+	frame = frame_new (kva);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame_link (frame, page);
+	return kva;
+}
+
+/* Maps PAGE, which has been read ahead.  If that fails, the next
+ * fault on it maps it instead. */
+void
+vm_prefetch_end (struct page *page) {
+	frame_map (page);
+	vm_policy->add (page->frame);
+}
+
+/* Claim the PAGE and set up the mmu. */
+static bool
+vm_do_claim_page (struct page *page) {
+	bool success;
+
+	lock_acquire (&frame_lock);
+	success = claim_page_locked (page);
+	lock_release (&frame_lock);
+	return success;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	spt->around_start = spt->around_end = NULL;
+	spt->around_window = 0;
+	spt->stack_bottom = (void *) USER_STACK;
+	spt->stack_chunk = 1;
+	spt->mlock_cnt = 0;
+}
+
+/* Shares SRC, an anonymous page, with the current thread, which
+ * gets its own page on SRC's frame.  Both map it read-only until
+ * they write to it.  The frame lock must be held. */
+static bool
+share_anon_page (struct page *src) {
+	struct page *dst;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	/* SRC may have been evicted; bring it back. */
+	if (!claim_page_locked (src))
+		return false;
+
+	dst = malloc (sizeof *dst);
+	if (dst == NULL)
+		return false;
+	*dst = *src;
+	dst->pml4 = thread_current ()->pml4;
+	dst->mlocked = false;
+	if (!spt_insert_page (&thread_current ()->spt, dst)) {
+		free (dst);
+		return false;
+	}
+
+	frame_link (src->frame, dst);
+	pml4_set_writable (src->pml4, src->va, false);
+	return frame_map (dst);
+}
+
+/* Adds a copy of SRC to the current thread's supplemental page
+ * table.  Pages that were never touched stay lazy, anonymous pages
+ * are shared copy-on-write, and file-backed pages are shared. */
+static bool
+copy_one_page (struct page *src, void *aux UNUSED) {
+	struct page *dst;
+	bool success;
+
+	if (VM_TYPE (src->operations->type) == VM_UNINIT) {
+		vm_initializer *init = src->uninit.init;
+		void *init_aux = src->uninit.aux;
+
+		if (init == vm_load_file_page
+				&& (init_aux = load_info_copy (init_aux)) == NULL)
+			return false;
+		if (!vm_alloc_page_with_initializer (src->uninit.type, src->va,
+					src->writable, init, init_aux)) {
+			if (init == vm_load_file_page)
+				load_info_free (init_aux);
+			return false;
+		}
+		spt_find_page (&thread_current ()->spt, src->va)->advice = src->advice;
+		return true;
+	}
+
+	if (VM_TYPE (src->operations->type) == VM_ANON) {
+		lock_acquire (&frame_lock);
+		success = share_anon_page (src);
+		lock_release (&frame_lock);
+		return success;
+	}
+
+	/* A file-backed page: the child maps the same part of the same
+	 * file, in the same frame if it is resident. */
+	ASSERT (VM_TYPE (src->operations->type) == VM_FILE);
+
+	lock_acquire (&frame_lock);
+	dst = file_page_dup (src);
+	success = dst != NULL;
+	if (success && src->frame != NULL) {
+		frame_link (src->frame, dst);
+		success = frame_map (dst);
+	}
+	lock_release (&frame_lock);
+	return success;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	ASSERT (dst == &thread_current ()->spt);
+
+	dst->stack_bottom = src->stack_bottom;
+	dst->stack_chunk = src->stack_chunk;
+	return spt_for_each (src, NULL, (void *) KERN_BASE, copy_one_page, NULL);
+}
+
+/* Frees NODE, a node at LEVEL, and everything below it. */
+static void
+spt_node_destroy (void **node, int level) {
+	for (size_t i = 0; i < SPT_FANOUT; i++) {
+		if (node[i] == NULL)
+			continue;
+		if (level == 0)
+			spt_release_page (node[i]);
+		else
+			spt_node_destroy (node[i], level - 1);
+	}
+	palloc_free_page (node);
+}
+
+/* Most file frames that vm_write_back() sorts at a time. */
+#define WRITEBACK_BATCH 32
+
+/* File frames about to be let go of, for vm_write_back(). */
+struct writeback_batch {
+	void *start, *end;                  /* Range being removed. */
+	struct frame *frames[WRITEBACK_BATCH];
+	size_t cnt;
+};
+
+/* spt_for_each() function that adds PAGE's frame to the
+ * writeback_batch AUX if it holds part of a file, is dirty, and
+ * is mapped by no page outside the batch's range.  Each frame is
+ * taken once, from its first page. */
+static bool
+writeback_page (struct page *page, void *aux) {
+	struct writeback_batch *batch = aux;
+	struct frame *frame = page->frame;
+	struct list_elem *e;
+
+	if (VM_TYPE (page->operations->type) != VM_FILE || frame == NULL
+			|| frame->page != page
+			|| (!frame->dirty && !frame_is_dirty (frame)))
+		return true;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *other = list_entry (e, struct page, frame_elem);
+
+		if (other->pml4 != page->pml4 || other->va < batch->start
+				|| other->va >= batch->end)
+			return true;
+	}
+
+	batch->frames[batch->cnt++] = frame;
+	if (batch->cnt == WRITEBACK_BATCH) {
+		file_write_back (batch->frames, batch->cnt);
+		batch->cnt = 0;
+	}
+	return true;
+}
+
+/* Writes back the dirty file frames that removing SPT's pages in
+ * [START, END) is about to let go of, sorted by file and offset,
+ * so that unmapping a region or exiting sweeps each file in order
+ * instead of following the address space.  Clean frames cost
+ * nothing, and the pages written find nothing left to write when
+ * they are destroyed.  Frames that other pages still map are
+ * written back when those let go of them. */
+void
+vm_write_back (struct supplemental_page_table *spt, void *start, void *end) {
+	struct writeback_batch batch;
+
+	batch.start = start;
+	batch.end = end;
+	batch.cnt = 0;
+	lock_acquire (&frame_lock);
+	spt_for_each (spt, start, end, writeback_page, &batch);
+	if (batch.cnt > 0)
+		file_write_back (batch.frames, batch.cnt);
+	lock_release (&frame_lock);
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	vm_write_back (spt, NULL, (void *) KERN_BASE);
+	if (spt->root != NULL)
+		spt_node_destroy (spt->root, SPT_LEVELS - 1);
+	supplemental_page_table_init (spt);
+}
+
+/* Returns the end of the user pages [ADDR, ADDR + LENGTH) passed
+ * to a system call, or NULL if ADDR is not page-aligned or the
+ * range is empty or reaches into the kernel. */
+static void *
+user_range_end (void *addr, size_t length) {
+	if (pg_ofs (addr) != 0 || length == 0 || !is_user_vaddr (addr)
+			|| length > (uint64_t) KERN_BASE - (uint64_t) addr)
+		return NULL;
+	return pg_round_up (addr + length);
+}
+
+/* spt_for_each() function that sets the advice of PAGE to *AUX. */
+static bool
+advise_page (struct page *page, void *advice) {
+	page->advice = *(int *) advice;
+	return true;
+}
+
+/* spt_for_each() function that reads PAGE in ahead of use, as far
+ * as free memory goes.  Untouched anonymous pages are left for the
+ * zero frame. */
+static bool
+willneed_page (struct page *page, void *aux UNUSED) {
+	if (page->frame != NULL || is_zero_page (page))
+		return true;
+	return prefetch_page (page);
+}
+
+/* Frames collected by dontneed_page() to evict in one batch. */
+struct dontneed_batch {
+	struct frame *victims[SWAP_CLUSTER];
+	size_t cnt;
+};
+
+/* Evicts the frames in BATCH and frees them all. */
+static void
+dontneed_flush (struct dontneed_batch *batch) {
+	struct frame *frame = evict_frames (batch->victims, batch->cnt);
+
+	if (frame != NULL)
+		frame_free (frame);
+	batch->cnt = 0;
+}
+
+/* spt_for_each() function that evicts PAGE right away, adding its
+ * frame to the dontneed_batch AUX.  Pages sharing a frame or
+ * locked in memory stay. */
+static bool
+dontneed_page (struct page *page, void *aux) {
+	struct dontneed_batch *batch = aux;
+	struct frame *frame = page->frame;
+
+	if (frame == &zero_frame) {
+		pml4_clear_page (page->pml4, page->va);
+		page->frame = NULL;
+		return true;
+	}
+	if (frame == NULL || frame->ref_cnt != 1 || frame->pinned
+			|| page->mlocked)
+		return true;
+
+	evict_prepare (frame);
+	batch->victims[batch->cnt++] = frame;
+	if (batch->cnt == SWAP_CLUSTER)
+		dontneed_flush (batch);
+	return true;
+}
+
+/* Applies ADVICE, one of the MADV_* values, to the current
+ * process's pages in [ADDR, ADDR + LENGTH):
+ *
+ * - MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL: how the pages will
+ *   be accessed.  Random access turns off fault-around and swap
+ *   read-ahead for them; sequential access starts fault-around at
+ *   its widest window.
+ *
+ * - MADV_WILLNEED: reads the pages in now, without evicting others
+ *   for them.
+ *
+ * - MADV_DONTNEED: evicts the pages now.  Unlike in Unix, their
+ *   contents are kept, since a page loaded from an executable no
+ *   longer knows where it came from.
+ *
+ * Returns 0 if successful, -1 if the arguments are bad. */
+int
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct dontneed_batch batch;
+	void *end = user_range_end (addr, length);
+	int result = 0;
+
+	if (end == NULL)
+		return -1;
+
+	lock_acquire (&frame_lock);
+	switch (advice) {
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			spt_for_each (spt, addr, end, advise_page, &advice);
+			break;
+		case MADV_WILLNEED:
+			spt_for_each (spt, addr, end, willneed_page, NULL);
+			break;
+		case MADV_DONTNEED:
+			batch.cnt = 0;
+			spt_for_each (spt, addr, end, dontneed_page, &batch);
+			if (batch.cnt > 0)
+				dontneed_flush (&batch);
+			break;
+		default:
+			result = -1;
+			break;
+	}
+	lock_release (&frame_lock);
+	return result;
+}
+
+/* spt_for_each() function that counts in *AUX the pages that are
+ * not locked in memory. */
+static bool
+count_unlocked (struct page *page, void *cnt) {
+	if (!page->mlocked)
+		(*(size_t *) cnt)++;
+	return true;
+}
+
+/* spt_for_each() function that brings PAGE in and locks it in
+ * memory, marking it as newly locked, unless it is locked
+ * already. */
+static bool
+mlock_page (struct page *page, void *aux UNUSED) {
+	if (page->mlocked)
+		return true;
+	if (!claim_page_locked (page))
+		return false;
+	page->mlocked = page->mlock_new = true;
+	return true;
+}
+
+/* spt_for_each() function that ends an mlock() call for PAGE: keeps
+ * a newly locked page locked if *AUX is true, or unlocks it again
+ * otherwise. */
+static bool
+mlock_finish (struct page *page, void *keep) {
+	if (page->mlock_new) {
+		page->mlock_new = false;
+		page->mlocked = *(bool *) keep;
+	}
+	return true;
+}
+
+/* spt_for_each() function that unlocks PAGE, counting in *AUX the
+ * pages that were locked. */
+static bool
+munlock_page (struct page *page, void *cnt) {
+	if (page->mlocked) {
+		page->mlocked = false;
+		(*(size_t *) cnt)++;
+	}
+	return true;
+}
+
+/* Locks the current process's pages in [ADDR, ADDR + LENGTH) in
+ * memory if LOCK is true, bringing them in first, or lets them be
+ * evicted again otherwise.  Locks do not nest, and fork does not
+ * pass them on.  A process may have at most MLOCK_MAX pages locked,
+ * and all processes together at most mlock_max.  Locking is all or
+ * nothing: if a page cannot be brought in, the pages the call
+ * already locked are unlocked again.  Returns 0 if successful, -1
+ * if the arguments are bad, the limits would be exceeded or memory
+ * runs out. */
+int
+vm_mlock (void *addr, size_t length, bool lock) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	void *end = user_range_end (addr, length);
+	size_t cnt = 0;
+	bool success;
+
+	if (end == NULL)
+		return -1;
+
+	lock_acquire (&frame_lock);
+	if (!lock) {
+		spt_for_each (spt, addr, end, munlock_page, &cnt);
+		spt->mlock_cnt -= cnt;
+		mlock_cnt -= cnt;
+		lock_release (&frame_lock);
+		return 0;
+	}
+
+	spt_for_each (spt, addr, end, count_unlocked, &cnt);
+	success = spt->mlock_cnt + cnt <= MLOCK_MAX
+		&& mlock_cnt + cnt <= mlock_max
+		&& spt_for_each (spt, addr, end, mlock_page, NULL);
+	spt_for_each (spt, addr, end, mlock_finish, &success);
+	if (success) {
+		spt->mlock_cnt += cnt;
+		mlock_cnt += cnt;
+	}
+	lock_release (&frame_lock);
+	return success ? 0 : -1;
+}
+
+/* Hash function for ksm_table. */
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->ksm_hash;
+}
+
+/* Comparison function for ksm_table. */
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->ksm_hash
+		< hash_entry (b, struct frame, ksm_elem)->ksm_hash;
+}
+
+/* Returns true if FRAME holds anonymous memory that may be merged
+ * with a frame holding the same. */
+static bool
+ksm_mergeable (struct frame *frame) {
+	return frame->ref_cnt > 0 && !frame->pinned && frame->inode == NULL
+		&& VM_TYPE (frame->page->operations->type) == VM_ANON;
+}
+
+/* Write-protects the mapped pages of FRAME, an anonymous frame, if
+ * PROTECT, so that writes fault into vm_handle_wp() and wait for
+ * the frame lock while FRAME is compared; otherwise gives them back
+ * the access frame_map() would. */
+static void
+ksm_protect (struct frame *frame, bool protect) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_get_page (page->pml4, page->va) != NULL)
+			pml4_set_writable (page->pml4, page->va,
+					!protect && page->writable && frame->ref_cnt == 1);
+	}
+}
+
+/* Moves the pages of FRAME onto KEEP, which holds the same, and
+ * frees FRAME.  Both must be write-protected.  The pages stay
+ * read-only, now shared copy-on-write. */
+static void
+ksm_merge (struct frame *frame, struct frame *keep) {
+	vm_policy->remove (frame);
+	while (frame->ref_cnt > 0) {
+		struct page *page = frame->page;
+		bool mapped = pml4_get_page (page->pml4, page->va) != NULL;
+
+		frame_unlink (frame, page);
+		frame_link (keep, page);
+		if (mapped && !frame_map (page))
+			pml4_clear_page (page->pml4, page->va);
+		ksm_page_cnt++;
+	}
+	frame_free (frame);
+	ksm_frame_cnt++;
+}
+
+/* Scans FRAME for same-page merging.  Only a frame whose contents
+ * hash the same as at its last scan is considered, since one that
+ * changes is likely to be written again soon.  It is merged into
+ * the candidate with the same hash if their contents match, and
+ * becomes a candidate itself otherwise.  The frame lock must be
+ * held. */
+static void
+ksm_scan_frame (struct frame *frame) {
+	struct hash_elem *e;
+	struct frame *other;
+	uint64_t hash;
+
+	if (!ksm_mergeable (frame))
+		return;
+	ksm_scan_cnt++;
+	hash = hash_bytes (frame->kva, PGSIZE);
+	if (hash != frame->ksm_hash) {
+		ksm_forget (frame);
+		frame->ksm_hash = hash;
+		return;
+	}
+	if (frame->ksm_listed)
+		return;
+
+	e = hash_find (&ksm_table, &frame->ksm_elem);
+	other = e != NULL ? hash_entry (e, struct frame, ksm_elem) : NULL;
+	if (other != NULL && ksm_mergeable (other)) {
+		ksm_protect (frame, true);
+		ksm_protect (other, true);
+		if (!memcmp (frame->kva, other->kva, PGSIZE)) {
+			ksm_merge (frame, other);
+			return;
+		}
+		ksm_protect (frame, false);
+		ksm_protect (other, false);
+	}
+
+	/* OTHER has changed since it was hashed, or cannot be merged
+	 * with now; FRAME takes its place. */
+	if (other != NULL)
+		ksm_forget (other);
+	hash_insert (&ksm_table, &frame->ksm_elem);
+	frame->ksm_listed = true;
+}
+
+/* Same-page merging daemon.  Every KSM_INTERVAL ticks, scans the
+ * next vm_ksm_pages frames of the frame table, round robin, so its
+ * cost stays bounded however much memory is in use.  The frame lock
+ * is let go every KSM_BATCH frames, so that faults do not wait for
+ * a whole pass; ksm_cursor stays valid meanwhile, since freeing a
+ * frame moves it along.  A write to a merged page gets it a copy of
+ * its own in vm_handle_wp(), like any other page shared
+ * copy-on-write. */
+static void
+ksm_daemon (void *aux UNUSED) {
+	for (;;) {
+		size_t i;
+
+		timer_sleep (KSM_INTERVAL);
+		lock_acquire (&frame_lock);
+		for (i = 0; i < vm_ksm_pages && !list_empty (&frame_table); i++) {
+			struct frame *frame;
+
+			if (ksm_cursor == NULL || ksm_cursor == list_end (&frame_table))
+				ksm_cursor = list_begin (&frame_table);
+			frame = list_entry (ksm_cursor, struct frame, elem);
+			ksm_cursor = list_next (ksm_cursor);
+			ksm_scan_frame (frame);
+			if (i % KSM_BATCH == KSM_BATCH - 1) {
+				lock_release (&frame_lock);
+				lock_acquire (&frame_lock);
+			}
+		}
+		lock_release (&frame_lock);
+	}
+}
+
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %s policy, %lld faults, %lld evictions, %lld reloads, "
+			"%lld COW copies, %lld COW reuses, %lld zero-page maps, "
+			"%lld mapped around faults\n",
+			vm_policy->name, fault_cnt, evict_cnt, reload_cnt, cow_copy_cnt,
+			cow_reuse_cnt, zero_map_cnt, around_cnt);
+	printf ("Stack: %lld faults grew it by %lld pages\n",
+			stack_fault_cnt, stack_page_cnt);
+	printf ("Reclaim: %zu/%zu pages low/high, %lld wakeups, "
+			"%lld pages evicted in the background, %lld on demand\n",
+			vm_reclaim_low, vm_reclaim_high, kswapd_wake_cnt, kswapd_evict_cnt,
+			evict_cnt - kswapd_evict_cnt);
+	printf ("KSM: %lld frames scanned, %lld pages merged, %lld kB saved\n",
+			ksm_scan_cnt, ksm_page_cnt, ksm_frame_cnt * PGSIZE / 1024);
+	vm_anon_print_stats ();
+	vm_file_print_stats ();
 }